@@ -51,6 +51,20 @@ MatrixXd FlatEmbedding::Derivative2( const VectorXd &x, uint32_t mu ) const {
 	return res;
 }
 
+VectorXd FlatEmbedding::DerivativeBlocks( const VectorXd& x ) const {
+	VectorXd X = (*this)(x);
+	VectorXd res(embedDim);
+	for(uint32_t k=0;k<embedDim;k+=2) {
+		res(k) = -X[k+1];
+		res(k+1) = X[k];
+	}
+	return res;
+}
+
+VectorXd FlatEmbedding::Derivative2Blocks( const VectorXd& x ) const {
+	return -(*this)(x);
+}
+
 void KuramotoWrap::operator()( VectorXd& state ) const {
 	for(int i=0;i<state.size();++i)
 		Wrap(state[i],-PI,PI);
@@ -78,15 +92,15 @@ complex<double> KuramotoBase::ComplexOrderParameter( const VectorXd& state ) con
 	return z;
 }
 
-double KuramotoBase::MeanAmplitudeDerivative( uint32_t j, const VectorXd &state, double psi ) const {
-	return ( cos(Phase(j,state)) * sin(psi) - sin(Phase(j,state)) * cos(psi) ) / numOscillators;
-}
-
-double KuramotoBase::MeanPhaseDerivative( uint32_t j, const VectorXd &state, double psi ) const {
-	return ( cos(Phase(j,state)) * cos(psi) + sin(Phase(j,state)) * sin(psi) ) / numOscillators;
+void KuramotoBase::PhaseComponents( const VectorXd& state, VectorXd& c, VectorXd& s ) const {
+	c.resize(numOscillators);
+	s.resize(numOscillators);
+	for(uint32_t i=0;i<numOscillators;++i) {
+		c(i) = cos(Phase(i,state));
+		s(i) = sin(Phase(i,state));
+	}
 }
 
-
 VectorXd KuramotoA::operator()( const VectorXd& state ) const {
 	complex<double> z = ComplexOrderParameter(state);
 	VectorXd s(numOscillators);
@@ -99,20 +113,27 @@ VectorXd KuramotoA::operator()( const VectorXd& state ) const {
 	return res;
 }
 
-MatrixXd KuramotoA::Partials( const VectorXd& state ) const {
-	MatrixXd res;
-	res.setZero(stateDim,stateDim);
-			
-	complex<double> z = ComplexOrderParameter(state);
-	double psi = arg(z);
-	double r = abs(z);
-	double forcing = Forcing(state);
-	for(uint32_t i=0;i<numOscillators;++i) {
-		for(uint32_t j=0;j<numOscillators;++j) {
-			res(i,j) = interactionStrengths[i] * forcing + K * MeanAmplitudeDerivative(j,state,psi) * sin( psi - Phase(i,state) ) + K  * cos( psi - Phase(i,state) ) * ( MeanPhaseDerivative(j,state,psi) - Delta<double>(i,j) * r );
-		}
-		res(i,stateDim-1) = interactionStrengths[i] * ForcingDerivative(state);
-	}
+/*
+ * With X + iY the complex order parameter, K r sin( psi - theta_i ) = K ( Y cos theta_i - X sin theta_i ),
+ * so the coupling contributes (K/N) cos( theta_i - theta_j ) - delta_ij K r cos( psi - theta_i ),
+ * a rank 2 matrix plus a diagonal. The forcing contributes a single column.
+ */
+DiagonalLowRank KuramotoA::Partials( const VectorXd& state ) const {
+	DiagonalLowRank res( stateDim, 3 );
+
+	VectorXd c, s;
+	PhaseComponents(state,c,s);
+	double X = c.mean();
+	double Y = s.mean();
+	double KN = K / numOscillators;
+
+	res.diagonal.head(numOscillators) = -K * ( X * c + Y * s );
+	res.U.col(0).head(numOscillators) = KN * c;
+	res.U.col(1).head(numOscillators) = KN * s;
+	res.U.col(2).head(numOscillators) = interactionStrengths * ForcingDerivative(state);
+	res.V.col(0).head(numOscillators) = c;
+	res.V.col(1).head(numOscillators) = s;
+	res.V(stateDim-1,2) = 1.0;
 	return res;
 }
 
@@ -129,21 +150,21 @@ VectorXd KuramotoB::operator()( const VectorXd& state ) const {
 	return res;
 }
 
-MatrixXd KuramotoB::Partials( const VectorXd& state ) const {
-	MatrixXd res;
-	res.setZero(stateDim,stateDim);
-			
-	complex<double> z = ComplexOrderParameter(state);
-	double psi = arg(z);
-	double r = abs(z);
-	double forcing = Forcing(state);
-	for(uint32_t i=0;i<numOscillators;++i) {
-		double sinPsiThetai = sin( psi - Phase(i,state) );
-		double cosPsiThetai = cos( psi - Phase(i,state) );
-		for(uint32_t j=0;j<numOscillators;++j) {
-			res(i,j) = (interactionStrengths[i] * forcing + K ) * ( MeanAmplitudeDerivative(j,state,psi) * sinPsiThetai + cosPsiThetai * ( MeanPhaseDerivative(j,state,psi) - Delta<double>(i,j) * r ) );
-		}
-		res(i,stateDim-1) = interactionStrengths[i] * ForcingDerivative(state) * r * sinPsiThetai;
-	}
+DiagonalLowRank KuramotoB::Partials( const VectorXd& state ) const {
+	DiagonalLowRank res( stateDim, 3 );
+
+	VectorXd c, s;
+	PhaseComponents(state,c,s);
+	double X = c.mean();
+	double Y = s.mean();
+	VectorXd g = interactionStrengths * Forcing(state) + K * VectorXd::Ones(numOscillators);
+
+	res.diagonal.head(numOscillators) = -g.cwiseProduct( X * c + Y * s );
+	res.U.col(0).head(numOscillators) = g.cwiseProduct(c) / numOscillators;
+	res.U.col(1).head(numOscillators) = g.cwiseProduct(s) / numOscillators;
+	res.U.col(2).head(numOscillators) = ( interactionStrengths * ForcingDerivative(state) ).cwiseProduct( Y * c - X * s );
+	res.V.col(0).head(numOscillators) = c;
+	res.V.col(1).head(numOscillators) = s;
+	res.V(stateDim-1,2) = 1.0;
 	return res;
 }
@@ -1,6 +1,7 @@
 #ifndef INCLUDED_KURAMOTO
 #define INCLUDED_KURAMOTO
 #include <DRDSP/dynamics/model.h>
+#include <DRDSP/eigen_low_rank.h>
 #include <complex>
 
 using namespace std;
@@ -32,30 +33,31 @@ protected:
 	double ForcingDerivative( const VectorXd& state ) const;
 	double Phase( uint32_t i, const VectorXd& state ) const;
 	complex<double> ComplexOrderParameter( const VectorXd& state ) const;
-	double MeanAmplitudeDerivative( uint32_t j, const VectorXd& state, double psi ) const;
-	double MeanPhaseDerivative( uint32_t j, const VectorXd& state, double psi ) const;
+	void PhaseComponents( const VectorXd& state, VectorXd& c, VectorXd& s ) const;
 };
 
 struct KuramotoA : KuramotoBase {
 	KuramotoA() = default;
 	explicit KuramotoA( uint32_t N ) : KuramotoBase(N) {}
 	VectorXd operator()( const VectorXd& state ) const;
-	MatrixXd Partials( const VectorXd& state ) const;
+	DiagonalLowRank Partials( const VectorXd& state ) const;
 };
 
 struct KuramotoB : KuramotoBase {
 	KuramotoB() = default;
 	explicit KuramotoB( uint32_t N ) : KuramotoBase(N) {}
 	VectorXd operator()( const VectorXd& state ) const;
-	MatrixXd Partials( const VectorXd& state ) const;
+	DiagonalLowRank Partials( const VectorXd& state ) const;
 };
 
-struct FlatEmbedding : Embedding {
-	explicit FlatEmbedding( uint32_t n ) : Embedding(n,2*n) {}
+struct FlatEmbedding : BlockDiagonalEmbedding {
+	explicit FlatEmbedding( uint32_t n ) : BlockDiagonalEmbedding( vector<uint32_t>(n,2) ) {}
 	VectorXd operator()( const VectorXd& x ) const;
 	MatrixXd Derivative( const VectorXd& x ) const;
 	MatrixXd DerivativeAdjoint( const VectorXd& x ) const;
 	MatrixXd Derivative2( const VectorXd& x, uint32_t mu ) const;
+	VectorXd DerivativeBlocks( const VectorXd& x ) const;
+	VectorXd Derivative2Blocks( const VectorXd& x ) const;
 };
 
 struct KuramotoAFamily : Family<KuramotoA> {
@@ -70,6 +70,22 @@ MatrixXd FlatEmbedding::Derivative( const VectorXd& state ) const {
 	return res;
 }
 
+VectorXd FlatEmbedding::DerivativeBlocks( const VectorXd& state ) const {
+	VectorXd X = (*this)(state);
+	VectorXd res(embedDim);
+
+	res(0) = -X(1);
+	res(1) = X(0);
+	res(2) = -X(3);
+	res(3) = X(2);
+	res(4) = -X(5);
+	res(5) = X(4);
+	res(6) = 1;
+	res(7) = 1;
+
+	return res;
+}
+
 MatrixXd DoughnutEmbedding::Derivative( const VectorXd& x ) const {
 	MatrixXd res;
 	res.setZero(embedDim,sourceDim);
@@ -141,6 +157,13 @@ MatrixXd FlatEmbedding::Derivative2( const VectorXd& x, uint32_t mu ) const {
 	return res;
 }
 
+VectorXd FlatEmbedding::Derivative2Blocks( const VectorXd& x ) const {
+	VectorXd res = -(*this)(x);
+	res(6) = 0;
+	res(7) = 0;
+	return res;
+}
+
 MatrixXd DoughnutEmbedding::Derivative2( const VectorXd& x, uint32_t mu ) const {
 	MatrixXd res;
 	res.setZero(sourceDim,sourceDim);
@@ -49,13 +49,14 @@ struct PendulumFamily : Family<Pendulum> {
 	}
 };
 
-struct FlatEmbedding : Embedding {
-	FlatEmbedding() : Embedding(5,8) {}
+struct FlatEmbedding : BlockDiagonalEmbedding {
+	FlatEmbedding() : BlockDiagonalEmbedding({2,2,2,1,1}) {}
 	VectorXd operator()( const VectorXd& x ) const;
 	MatrixXd Derivative( const VectorXd& x ) const;
 	MatrixXd DerivativeAdjoint( const VectorXd& x ) const;
 	MatrixXd Derivative2( const VectorXd& x, uint32_t mu ) const;
-	
+	VectorXd DerivativeBlocks( const VectorXd& x ) const;
+	VectorXd Derivative2Blocks( const VectorXd& x ) const;
 };
 
 struct DoughnutEmbedding : Embedding {
@@ -1,6 +1,7 @@
 #ifndef INCLUDED_AUTO_DIFF
 #define INCLUDED_AUTO_DIFF
 #include "eigen_dual.h"
+#include "eigen_reverse.h"
 #include <Eigen/SparseCore>
 
 namespace DRDSP {
@@ -46,6 +47,35 @@ namespace DRDSP {
 		return df;
 	}
 
+	/**
+	 * Gradient of a scalar function by reverse-mode differentiation. The cost is a small multiple of
+	 * one evaluation of f, independent of the number of inputs. The tape is cleared on entry, so its
+	 * storage can be reused across calls. Returns the value of f.
+	 */
+	template<typename F>
+	double AutoGradient( Taped& tape, F&& f, const VectorXd& x, VectorXd& gradient ) {
+		tape.Clear();
+		Taped::Scope scope(tape);
+
+		TapeVectorXd r = Variables( x );
+		tvard y = forward<F>(f)( r );
+
+		const auto& adjoints = tape.Backward( y.index );
+		gradient.resize( x.size() );
+		for(int64_t j=0;j<x.size();++j) {
+			gradient[j] = adjoints[r[j].index];
+		}
+		return y.x;
+	}
+
+	template<typename F>
+	VectorXd AutoGradient( F&& f, const VectorXd& x ) {
+		Taped tape( 64 * x.size() );
+		VectorXd gradient;
+		AutoGradient( tape, forward<F>(f), x, gradient );
+		return gradient;
+	}
+
 }
 
 #endif
@@ -0,0 +1,109 @@
+#ifndef INCLUDED_DYNAMICS_BASIS_CACHE
+#define INCLUDED_DYNAMICS_BASIS_CACHE
+#include "reduced_data_system.h"
+#include "packed_rbf_model.h"
+#include "local_rbf_model.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief The scalar basis of a family with HasKroneckerStructure, evaluated at every reduced point.
+	 *
+	 * For each data set this stores B = [b(x_1) ... b(x_N)] and Db = [Db(x_1) ... Db(x_N)] along
+	 * with the targets V = [v_1 ... v_N] and Y = [Y_1 ... Y_N]. A model with coefficients P then
+	 * has values P B and derivatives P Db, so the kernels are evaluated once per centre set and
+	 * shared between the fit and the cost.
+	 *
+	 * V and Y are copied again only when the data set or its ReducedData::generation changes. Call
+	 * ReducedData::Modified after editing its vectors or derivatives in place.
+	 */
+	struct BasisCache {
+		struct Entry {
+			MatrixXd B,     ///< m x N basis values
+			         Db,    ///< m x dN basis derivatives
+			         V,     ///< d x N vectors
+			         Y;     ///< d x dN derivatives
+			double scales[2];
+			size_t count = 0;
+			const ReducedData* source = nullptr;
+			uint64_t generation = 0;  ///< source->generation when V and Y were copied
+		};
+
+		vector<Entry> entries;
+		uint32_t dimension = 0,  ///< d, the dimension of the reduced space
+		         basisDim = 0;   ///< m, the number of scalar basis functions
+
+		template<typename Family>
+		BasisCache& Compute( const Family& family, const ReducedDataSystem& data ) {
+			entries.resize( data.numParameters );
+			auto model = family( VectorXd::Zero(family.paramDim) );
+			for(uint32_t j=0;j<data.numParameters;++j) {
+				Compute( model, data[j], entries[j] );
+			}
+			return *this;
+		}
+
+		template<typename Family>
+		BasisCache& Compute( const Family& family, const ReducedData& data ) {
+			entries.resize( 1 );
+			Compute( family( VectorXd::Zero(family.paramDim) ), data, entries[0] );
+			return *this;
+		}
+
+		/// The normal equations P G = R, with weights w1 and w2 on the vector and derivative terms
+		void ComputeGram( const Entry& e, double w1, double w2, MatrixXd& G, MatrixXd& R ) const {
+			G.setZero( basisDim, basisDim );
+			G.selfadjointView<Lower>().rankUpdate( e.B, w1 );
+			G.selfadjointView<Lower>().rankUpdate( e.Db, w2 );
+			G.triangularView<StrictlyUpper>() = G.transpose();
+			R.noalias() = w1 * ( e.V * e.B.transpose() );
+			R.noalias() += w2 * ( e.Y * e.Db.transpose() );
+		}
+
+		/// The mean squared errors of the model with coefficients P, weighted by w1 and w2
+		double ComputeCost( const Entry& e, const MatrixXd& P, double w1, double w2 ) const {
+			double S1 = ( P * e.B - e.V ).squaredNorm() / e.count;
+			double S2 = ( P * e.Db - e.Y ).squaredNorm() / e.count;
+			return w1 * S1 + w2 * S2;
+		}
+
+	protected:
+
+		template<typename Model>
+		void Compute( const Model& model, const ReducedData& data, Entry& e ) {
+			dimension = data.dimension;
+			basisDim = dimension + (uint32_t)model.rbfs.size();
+			e.count = data.count;
+			e.scales[0] = data.scales[0];
+			e.scales[1] = data.scales[1];
+
+			if( e.source != &data || e.generation != data.generation || e.V.cols() != (int64_t)data.count ) {
+				e.V.resize( dimension, data.count );
+				e.Y.resize( dimension, dimension * data.count );
+				for(size_t i=0;i<data.count;++i) {
+					e.V.col(i) = data.vectors[i];
+					e.Y.middleCols( i * dimension, dimension ) = data.derivatives[i];
+				}
+				e.source = &data;
+				e.generation = data.generation;
+			}
+
+			e.B.resize( basisDim, data.count );
+			e.Db.resize( basisDim, dimension * data.count );
+			DispatchDimension( model, [&]( const auto& m ) {
+				VectorXd b;
+				MatrixXd Db;
+				for(size_t i=0;i<data.count;++i) {
+					m.ComputeBasis( data.points[i], b, Db );
+					e.B.col(i) = b;
+					e.Db.middleCols( i * dimension, dimension ) = Db;
+				}
+			});
+		}
+	};
+
+}
+
+#endif
@@ -4,8 +4,10 @@
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <future>
 #include <stdint.h>
 #include "../bitmap.h"
+#include "dynamicalSystem.h"
 
 using namespace std;
 
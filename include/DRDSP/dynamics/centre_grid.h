@@ -0,0 +1,57 @@
+#ifndef INCLUDED_DYNAMICS_CENTRE_GRID
+#define INCLUDED_DYNAMICS_CENTRE_GRID
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include "../types.h"
+
+namespace DRDSP {
+
+	/**
+	 * \brief A uniform grid over a set of points, for finding those within a fixed radius of x.
+	 *
+	 * Each point is stored in the cell of side cellSize that contains it, with the cells hashed by
+	 * their integer coordinates. Query checks the 3^d cells around x, so the cell size must be at
+	 * least the query radius. A hash collision only adds candidates, which the distance test then
+	 * rejects.
+	 */
+	struct CentreGrid {
+		MatrixXd points;        ///< Column i is point i
+		VectorXd origin;
+		double cellSize = 1.0;
+
+		CentreGrid() = default;
+		CentreGrid( const std::vector<VectorXd>& points, double cellSize );
+		CentreGrid( const MatrixXd& points, double cellSize );
+
+		void Build( const MatrixXd& points, double cellSize );
+
+		size_t Size() const {
+			return (size_t)points.cols();
+		}
+
+		/// Calls visit( i, r ) for each point i at distance r < radius from x, with radius <= cellSize
+		template<typename Visitor>
+		void Query( const VectorXd& x, double radius, Visitor&& visit ) const {
+			std::vector<uint64_t>& keys = NeighbourKeys( x );
+			const double radius2 = radius * radius;
+			for( uint64_t key : keys ) {
+				auto it = cells.find( key );
+				if( it == cells.end() ) continue;
+				for( uint32_t i : it->second ) {
+					double r2 = ( x - points.col(i) ).squaredNorm();
+					if( r2 < radius2 ) visit( i, std::sqrt(r2) );
+				}
+			}
+		}
+
+	protected:
+		std::unordered_map<uint64_t,std::vector<uint32_t>> cells;
+
+		uint64_t Key( const std::vector<int64_t>& cell ) const;
+		std::vector<uint64_t>& NeighbourKeys( const VectorXd& x ) const;
+	};
+
+}
+
+#endif
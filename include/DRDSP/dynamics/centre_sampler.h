@@ -0,0 +1,66 @@
+#ifndef INCLUDED_DYNAMICS_CENTRE_SAMPLER
+#define INCLUDED_DYNAMICS_CENTRE_SAMPLER
+#include <vector>
+#include <random>
+#include "../types.h"
+#include "../data/aabb.h"
+#include "../philox.h"
+#include "reduced_data_system.h"
+
+namespace DRDSP {
+
+	/**
+	 * \brief Chooses candidate RBF centres for the brute force producers.
+	 *
+	 * Every method draws its randomness from the given generator, either an mt19937 or a per-trial
+	 * Philox4x32 stream, so the centres are reproducible.
+	 *
+	 * - Uniform: independent uniform points in the box.
+	 * - Halton: consecutive points of the Halton sequence from a random start.
+	 * - Sobol: the first points of the Sobol sequence with a random digital shift. Falls back to
+	 *   Halton above 16 dimensions.
+	 * - KMeansPlusPlus: k-means++ seeding on the point cloud.
+	 * - PointCloud: cloud points jittered by a Gaussian of width thickness, relative to the box.
+	 *
+	 * The last two need SetCloud. Each centre set from Halton and Sobol is spread evenly over the box,
+	 * while the cloud methods keep the centres near the data. The cloud methods suit localized kernels
+	 * such as Gaussian. Kernels with a log term, such as ThinPlateSpline, fit poorly with centres on
+	 * the data, so use PointCloud with a larger thickness for them.
+	 */
+	struct CentreSampler {
+		enum class Method : uint8_t {
+			Uniform,
+			Halton,
+			Sobol,
+			KMeansPlusPlus,
+			PointCloud
+		};
+
+		std::vector<VectorXd> cloud;
+		Method method = Method::Uniform;
+		double thickness = 0.05;      ///< Standard deviation of the PointCloud jitter, relative to the box
+		uint32_t maxPoints = 5000;    ///< SetCloud keeps at most this many points
+
+		CentreSampler() = default;
+		explicit CentreSampler( Method method ) : method(method) {}
+
+		/// Takes the reduced points as the cloud, if the method needs one
+		CentreSampler& SetCloud( const ReducedData& data );
+		CentreSampler& SetCloud( const ReducedDataSystem& data );
+
+		void Sample( std::vector<VectorXd>& centres, const AABB& box, std::mt19937& mt ) const;
+		void Sample( std::vector<VectorXd>& centres, const AABB& box, Philox4x32& rng ) const;
+
+	protected:
+		bool NeedsCloud() const;
+		template<typename Generator> void SampleWith( std::vector<VectorXd>& centres, const AABB& box, Generator& gen ) const;
+		template<typename Generator> void SampleUniform( std::vector<VectorXd>& centres, const AABB& box, Generator& gen ) const;
+		template<typename Generator> void SampleHalton( std::vector<VectorXd>& centres, const AABB& box, Generator& gen ) const;
+		template<typename Generator> void SampleSobol( std::vector<VectorXd>& centres, const AABB& box, Generator& gen ) const;
+		template<typename Generator> void SampleKMeansPlusPlus( std::vector<VectorXd>& centres, Generator& gen ) const;
+		template<typename Generator> void SamplePointCloud( std::vector<VectorXd>& centres, const AABB& box, Generator& gen ) const;
+	};
+
+}
+
+#endif
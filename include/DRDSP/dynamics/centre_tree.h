@@ -0,0 +1,42 @@
+#ifndef INCLUDED_DYNAMICS_CENTRE_TREE
+#define INCLUDED_DYNAMICS_CENTRE_TREE
+#include <vector>
+#include "../types.h"
+
+namespace DRDSP {
+
+	/**
+	 * \brief A k-d tree over a set of points, for Barnes-Hut style summation.
+	 *
+	 * Each node splits its points at the median of its widest coordinate, down to at most leafSize
+	 * points per leaf. The points are stored in tree order, so each node covers a contiguous range
+	 * of columns, and index maps tree order back to the original order.
+	 */
+	struct CentreTree {
+		struct Node {
+			uint32_t begin, end;     ///< The range of points in tree order
+			int32_t left, right;     ///< Child nodes, -1 for a leaf
+			VectorXd centre;         ///< Mean of the points
+			double radius;           ///< Largest distance from centre to a point
+
+			bool IsLeaf() const {
+				return left < 0;
+			}
+		};
+
+		std::vector<Node> nodes;     ///< nodes[0] is the root
+		std::vector<uint32_t> index; ///< index[i] is the original index of point i in tree order
+		MatrixXd points;             ///< Column i is point index[i]
+
+		CentreTree() = default;
+		CentreTree( const MatrixXd& points, uint32_t leafSize );
+
+		void Build( const MatrixXd& points, uint32_t leafSize );
+
+	protected:
+		int32_t BuildNode( uint32_t begin, uint32_t end, uint32_t leafSize );
+	};
+
+}
+
+#endif
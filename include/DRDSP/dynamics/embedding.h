@@ -1,6 +1,8 @@
 #ifndef INCLUDED_DYNAMICS_EMBEDDING
 #define INCLUDED_DYNAMICS_EMBEDDING
 #include "../types.h"
+#include <vector>
+#include <type_traits>
 
 namespace DRDSP {
 
@@ -37,6 +39,76 @@ namespace DRDSP {
 
 	};
 
+	/**
+	 * \brief Base for an embedding where each embedding coordinate depends on a single state coordinate.
+	 *
+	 * Rows blockOffsets[j] to blockOffsets[j+1] of the embedding depend only on state coordinate j,
+	 * so the derivative is block diagonal with blocks of one column. Derived embeddings provide
+	 *
+	 *   VectorXd DerivativeBlocks( const VectorXd& x ) const;   // d e_mu / d x_j, stacked by row
+	 *   VectorXd Derivative2Blocks( const VectorXd& x ) const;  // d^2 e_mu / d x_j^2, stacked by row
+	 *
+	 * along with the dense Derivative, DerivativeAdjoint and Derivative2 of a general embedding.
+	 * DerivativeAdjoint is assumed to be the transpose of Derivative.
+	 */
+	struct BlockDiagonalEmbedding : Embedding {
+		std::vector<uint32_t> blockOffsets;
+
+		explicit BlockDiagonalEmbedding( const std::vector<uint32_t>& blockSizes ) :
+			Embedding( (uint32_t)blockSizes.size(), 0 ),
+			blockOffsets( blockSizes.size() + 1 )
+		{
+			blockOffsets[0] = 0;
+			for(uint32_t j=0;j<sourceDim;++j) {
+				blockOffsets[j+1] = blockOffsets[j] + blockSizes[j];
+			}
+			embedDim = blockOffsets[sourceDim];
+		}
+
+		uint32_t BlockSize( uint32_t j ) const {
+			return blockOffsets[j+1] - blockOffsets[j];
+		}
+
+		/// Computes W^T B for a block diagonal matrix B with the given stacked column blocks
+		void ProjectBlocks( const MatrixXd& W, const VectorXd& blocks, MatrixXd& result ) const {
+			result.resize( W.cols(), sourceDim );
+			for(uint32_t j=0;j<sourceDim;++j) {
+				result.col(j).noalias() = W.middleRows( blockOffsets[j], BlockSize(j) ).transpose() * blocks.segment( blockOffsets[j], BlockSize(j) );
+			}
+		}
+	};
+
+	template<typename E>
+	void ProjectEmbeddingDerivatives( const E& embedding, const VectorXd& x, const VectorXd& v, const MatrixXd& W, MatrixXd& WtD, MatrixXd& WtH, MatrixXd& DtW, std::false_type ) {
+		MatrixXd H( embedding.embedDim, embedding.sourceDim );
+		for(uint32_t i=0;i<embedding.embedDim;++i) {
+			H.row(i).noalias() = ( embedding.Derivative2(x,i) * v ).transpose();
+		}
+		WtD.noalias() = W.adjoint() * embedding.Derivative(x);
+		WtH.noalias() = W.adjoint() * H;
+		DtW.noalias() = embedding.DerivativeAdjoint(x) * W;
+	}
+
+	template<typename E>
+	void ProjectEmbeddingDerivatives( const E& embedding, const VectorXd& x, const VectorXd& v, const MatrixXd& W, MatrixXd& WtD, MatrixXd& WtH, MatrixXd& DtW, std::true_type ) {
+		embedding.ProjectBlocks( W, embedding.DerivativeBlocks(x), WtD );
+		embedding.ProjectBlocks( W, embedding.Derivative2Blocks(x), WtH );
+		WtH *= v.asDiagonal();
+		DtW = WtD.transpose();
+	}
+
+	/**
+	 * \brief Projections of the first and second derivatives of an embedding.
+	 *
+	 * Computes W^T D, W^T H and D^* W, where D is the derivative at x and row i of H is
+	 * the second derivative of the ith embedding component applied to v. Block diagonal
+	 * embeddings never form the dense matrices.
+	 */
+	template<typename E>
+	void ProjectEmbeddingDerivatives( const E& embedding, const VectorXd& x, const VectorXd& v, const MatrixXd& W, MatrixXd& WtD, MatrixXd& WtH, MatrixXd& DtW ) {
+		ProjectEmbeddingDerivatives( embedding, x, v, W, WtD, WtH, DtW, typename std::is_base_of<BlockDiagonalEmbedding,E>::type() );
+	}
+
 	template<typename E>
 	MatrixXd ComputeInducedMetric( const E& embedding, const VectorXd& x ) {
 		MatrixXd deriv = embedding.Derivative(x);
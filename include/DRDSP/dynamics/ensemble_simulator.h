@@ -0,0 +1,202 @@
+#ifndef INCLUDED_DYNAMICS_ENSEMBLE_SIMULATOR
+#define INCLUDED_DYNAMICS_ENSEMBLE_SIMULATOR
+#include <vector>
+#include <utility>
+#include "../misc.h"
+#include "../eigen_affine.h"
+#include "rbf_family.h"
+#include "packed_rbf_model.h"
+#include "bifurcation.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Simulates a reduced family at many parameters and initial conditions at once.
+	 *
+	 * The ensemble has one member for each pair of a parameter and an initial condition. The
+	 * coefficients of every member, theta = A p + b, are computed up front with one matrix product.
+	 * The states and coefficients are stored structure-of-arrays, with one row per component and one
+	 * column per member. The model is then evaluated one kernel at a time for a whole block of
+	 * members, with array operations along the rows, and integrated with fixed step RK4.
+	 *
+	 * Blocks of blockSize members are integrated independently, so that a block stays in cache, and
+	 * are shared between threads.
+	 */
+	template<typename R>
+	struct EnsembleSimulator {
+		typedef PMapFamily<RBFFamily<RBF<R>>,AffineXd> Family;
+		typedef VectorXd Parameter;
+		typedef VectorXd State;
+		typedef double Time;
+		typedef double Value;
+		typedef Array<double,Dynamic,Dynamic,RowMajor> Ensemble;  ///< Row i is component i over the members
+
+		Time tStart = 0,         ///< Time to integrate before sampling
+		     tInterval = 10,     ///< Length of the sampled interval
+		     dt = 0.01,          ///< Sampling interval
+		     dtMax = 0;          ///< Largest integration step, dt if zero
+		uint32_t blockSize = 256;
+
+		EnsembleSimulator() = default;
+
+		explicit EnsembleSimulator( const Family& family ) {
+			Load( family );
+		}
+
+		void Load( const Family& family ) {
+			stateDim = family.family.stateDim;
+			centres.resize( stateDim, family.family.centres.size() );
+			for(size_t k=0;k<family.family.centres.size();++k) {
+				centres.col(k) = family.family.centres[k];
+			}
+			func = family.family.prototype.func;
+			pmap = family.pmap;
+		}
+
+		/// The states of all members after tStart, column i * initials.size() + j for parameter i and initial j
+		MatrixXd Simulate( const vector<Parameter>& parameters, const vector<State>& initials, uint32_t numThreads = 1 ) const {
+			const size_t members = parameters.size() * initials.size();
+			MatrixXd result( stateDim, members );
+			ParallelRanges( NumBlocks( members ), numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+				Workspace w;
+				for(size_t b=begin;b<end;++b) {
+					size_t first = b * blockSize, count = std::min<size_t>( blockSize, members - first );
+					Initialize( w, parameters, initials, first, count );
+					Advance( w, tStart );
+					result.middleCols( first, count ) = w.x.matrix();
+				}
+			});
+			return result;
+		}
+
+		/**
+		 * \brief A bifurcation diagram over parameters, as BifurcationDiagramGenerator::Generate.
+		 *
+		 * Each member is integrated for tStart, then sampled every dt for tInterval. Whenever
+		 * condition( prev, state ) holds for consecutive samples, getValue( prev, state ) is recorded
+		 * against the member's parameter. The data is grouped by parameter, in the given order.
+		 */
+		template<typename Condition,typename GetValue>
+		BifurcationDiagram<Parameter,Value> Generate( const vector<Parameter>& parameters, const vector<State>& initials, Condition&& condition, GetValue&& getValue, uint32_t numThreads = 1 ) const {
+			const size_t members = parameters.size() * initials.size();
+			vector<vector<Value>> values( members );
+			ParallelRanges( NumBlocks( members ), numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+				Workspace w;
+				Ensemble prev;
+				State a( stateDim ), b( stateDim );
+				for(size_t k=begin;k<end;++k) {
+					size_t first = k * blockSize, count = std::min<size_t>( blockSize, members - first );
+					Initialize( w, parameters, initials, first, count );
+					Advance( w, tStart );
+					for(Time t=0;t<=tInterval;t+=dt) {
+						prev = w.x;
+						Advance( w, dt );
+						for(size_t m=0;m<count;++m) {
+							a = prev.col(m);
+							b = w.x.col(m);
+							if( condition( a, b ) ) {
+								values[first+m].push_back( getValue( a, b ) );
+							}
+						}
+					}
+				}
+			});
+			BifurcationDiagram<Parameter,Value> diagram( (uint32_t)parameters.size() );
+			for(size_t m=0;m<members;++m) {
+				for(Value v : values[m]) {
+					diagram.data.emplace_back( parameters[ m / initials.size() ], v );
+				}
+			}
+			return diagram;
+		}
+
+		template<typename Condition,typename GetValue>
+		BifurcationDiagram<Parameter,Value> Generate( const vector<Parameter>& parameters, const State& initial, Condition&& condition, GetValue&& getValue, uint32_t numThreads = 1 ) const {
+			return Generate( parameters, vector<State>( 1, initial ), condition, getValue, numThreads );
+		}
+
+		/// f = model(x) for each member of a block
+		void Evaluate( const Ensemble& theta, const Ensemble& x, Ensemble& f ) const {
+			static thread_local ArrayXd r2, phi, dphi;
+			const int64_t n = x.cols(), K = centres.cols();
+			f.resize( stateDim, n );
+			for(uint32_t i=0;i<stateDim;++i) {
+				f.row(i) = theta.row(i) * x.row(0);
+				for(uint32_t j=1;j<stateDim;++j) {
+					f.row(i) += theta.row( j * stateDim + i ) * x.row(j);
+				}
+			}
+			for(int64_t k=0;k<K;++k) {
+				r2 = ( x.row(0) - centres(0,k) ).square().transpose();
+				for(uint32_t j=1;j<stateDim;++j) {
+					r2 += ( x.row(j) - centres(j,k) ).square().transpose();
+				}
+				PackedKernel<R>::Evaluate( func, r2, phi, dphi );
+				for(uint32_t i=0;i<stateDim;++i) {
+					f.row(i) += theta.row( ( k + stateDim ) * stateDim + i ) * phi.transpose();
+				}
+			}
+		}
+
+	protected:
+		uint32_t stateDim = 0;
+		MatrixXd centres;   ///< Column k is the centre of kernel k
+		R func;
+		AffineXd pmap;
+
+		struct Workspace {
+			Ensemble theta,  ///< Column m is the coefficients of member m, in RBFFamily order
+			         x, y, k1, k2, k3, k4;
+		};
+
+		size_t NumBlocks( size_t members ) const {
+			size_t size = std::max( blockSize, 1u );
+			return ( members + size - 1 ) / size;
+		}
+
+		void Initialize( Workspace& w, const vector<Parameter>& parameters, const vector<State>& initials, size_t first, size_t count ) const {
+			const size_t numInitials = initials.size();
+			MatrixXd P( pmap.linear.cols(), count );
+			w.x.resize( stateDim, count );
+			for(size_t m=0;m<count;++m) {
+				P.col(m) = parameters[ ( first + m ) / numInitials ];
+				w.x.col(m) = initials[ ( first + m ) % numInitials ].array();
+			}
+			MatrixXd theta = pmap.linear * P;
+			theta.colwise() += pmap.translation;
+			w.theta = theta.array();
+		}
+
+		/// Integrates a block for time T, in equal steps of at most dtMax, or dt if dtMax is zero
+		void Advance( Workspace& w, Time T ) const {
+			if( T <= 0.0 ) return;
+			const Time hMax = dtMax > 0.0 ? dtMax : dt;
+			Time h = T;
+			uint32_t n = 1;
+			if( T > hMax && hMax > 0.0 ) {
+				n = uint32_t( T / hMax + 1.0 );
+				h = T / n;
+			}
+			for(uint32_t i=0;i<n;++i) {
+				Evaluate( w.theta, w.x, w.k1 );
+				w.y = w.x + ( 0.5 * h ) * w.k1;
+				Evaluate( w.theta, w.y, w.k2 );
+				w.y = w.x + ( 0.5 * h ) * w.k2;
+				Evaluate( w.theta, w.y, w.k3 );
+				w.y = w.x + h * w.k3;
+				Evaluate( w.theta, w.y, w.k4 );
+				w.x += ( w.k1 + 2.0 * ( w.k2 + w.k3 ) + w.k4 ) * ( h / 6.0 );
+			}
+		}
+	};
+
+	template<typename R>
+	EnsembleSimulator<R> MakeEnsembleSimulator( const PMapFamily<RBFFamily<RBF<R>>,AffineXd>& family ) {
+		return EnsembleSimulator<R>( family );
+	}
+
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef INCLUDED_DYNAMICS_INCREMENTAL_PARAMETER_MAP
+#define INCLUDED_DYNAMICS_INCREMENTAL_PARAMETER_MAP
+#include <map>
+#include <Eigen/Cholesky>
+#include "parameter_map_producer.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Keeps the fit of SolveOrig up to date as data sets are added and removed.
+	 *
+	 * The normal equations of SolveOrig are a sum over data sets of D(p)^T G D(p), where G has the
+	 * size of the family's coefficients. G, which costs a pass over the data set's points, is kept
+	 * for each data set, so adding or removing one only adds or subtracts its term from the sum.
+	 * The other data sets are not computed again.
+	 *
+	 * The next Solve then refactorizes the sum with LLT, falling back to the FullPivLU of SolveOrig
+	 * while it is not positive definite. Removing the last data set clears the sum rather than
+	 * leaving its rounding error, and Solve returns a zero map while there are no data sets.
+	 *
+	 * To add points to a data set already added, add them as a data set of their own at the same
+	 * parameter, with the same scales.
+	 */
+	template<typename Family>
+	struct IncrementalParameterMap : ParameterMapProducer<Family> {
+		using ParameterMapProducer<Family>::Solve;
+
+		Family family;
+
+		explicit IncrementalParameterMap( const Family& family ) : family(family) {}
+
+		/// Adds the data set at the given parameter and returns a handle for Remove
+		uint32_t Add( const ReducedData& data, const VectorXd& parameter ) {
+			Contribution c = ComputeContribution( data, parameter );
+			parameterDim = parameter.size();
+			if( A.size() == 0 ) {
+				const int64_t n = family.paramDim * c.c.size();
+				A.setZero( n, n );
+				B.setZero( n );
+			}
+			Accumulate( c, 1.0 );
+			contributions.emplace( nextHandle, std::move(c) );
+			return nextHandle++;
+		}
+
+		/// Adds each data set of the system, returning their handles
+		vector<uint32_t> Add( const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
+			vector<uint32_t> handles( data.numParameters );
+			for(uint32_t i=0;i<data.numParameters;++i) {
+				handles[i] = Add( data.reducedData[i], parameters[i] );
+			}
+			return handles;
+		}
+
+		void Remove( uint32_t handle ) {
+			auto it = contributions.find( handle );
+			if( it == contributions.end() ) return;
+			Accumulate( it->second, -1.0 );
+			contributions.erase( it );
+			if( contributions.empty() ) {
+				Clear();
+			}
+		}
+
+		void Clear() {
+			contributions.clear();
+			A.resize(0,0);
+			B.resize(0);
+			factorized = false;
+		}
+
+		size_t Size() const {
+			return contributions.size();
+		}
+
+		/// The parameter map fitted to the data sets currently added, or a zero map if there are none
+		AffineXd Solve() {
+			if( contributions.empty() ) {
+				AffineXd zero( family.paramDim, parameterDim );
+				return zero.setZero();
+			}
+			if( !factorized ) {
+				llt.compute( A );
+				factorized = llt.info() == Success;
+			}
+			if( factorized ) {
+				return VecToAffine( llt.solve(B), family.paramDim );
+			}
+			return VecToAffine( Eigen::FullPivLU<MatrixXd>(A).solve(B), family.paramDim );
+		}
+
+	protected:
+		struct Contribution {
+			VectorXd c;    ///< [p;1], with D(p)^T u = c (x) u
+			MatrixXd G;
+			VectorXd Aty;
+		};
+
+		map<uint32_t,Contribution> contributions;
+		MatrixXd A;
+		VectorXd B;
+		LLT<MatrixXd> llt;
+		bool factorized = false;
+		uint32_t nextHandle = 0;
+		int64_t parameterDim = 0;  ///< Size of the parameters added so far, the sourceDim of the solution
+
+		/// Adds sigma times the data set's term, (c c^T) (x) G and c (x) A^T y, to the normal equations
+		void Accumulate( const Contribution& c, double sigma ) {
+			const int64_t ldim = family.paramDim;
+			const int64_t q = c.c.size();
+			for(int64_t a=0;a<q;++a) {
+				B.segment( a * ldim, ldim ) += ( sigma * c.c(a) ) * c.Aty;
+				for(int64_t b=0;b<q;++b) {
+					A.block( a * ldim, b * ldim, ldim, ldim ) += ( sigma * c.c(a) * c.c(b) ) * c.G;
+				}
+			}
+			factorized = false;
+		}
+
+		Contribution ComputeContribution( const ReducedData& data, const VectorXd& parameter ) const {
+			NormalEquations eq = this->ComputeNormalEquations( family, data );
+			Contribution result;
+			result.c.resize( parameter.size() + 1 );
+			result.c << parameter, 1.0;
+			result.G = eq.Matrix();
+			result.Aty = eq.Aty;
+			return result;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef INCLUDED_DYNAMICS_LOCAL_RBF_MODEL
+#define INCLUDED_DYNAMICS_LOCAL_RBF_MODEL
+#include <vector>
+#include "rbf_model.h"
+#include "centre_grid.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief An RBFModel with compactly supported RBF<R> kernels, evaluated through a CentreGrid.
+	 *
+	 * Only the centres within SupportRadius of x are visited, so an evaluation costs the number of
+	 * nearby kernels rather than the total. The radial function is shared by all kernels and is
+	 * taken from the first RBF of the model.
+	 */
+	template<typename R>
+	struct LocalRBFModel : Model<VectorXd> {
+		MatrixXd linear,
+		         weights;  ///< Column k is the weight of kernel k
+		CentreGrid grid;   ///< Over the centres, column k of grid.points is centre k
+		R func;
+
+		LocalRBFModel() = default;
+
+		explicit LocalRBFModel( const RBFModel<RBF<R>>& model ) :
+			Model<VectorXd>(model.stateDim),
+			linear(model.linear),
+			weights(model.stateDim,model.rbfs.size())
+		{
+			static_assert( HasCompactSupport<R>::value, "LocalRBFModel requires a compactly supported radial function" );
+			MatrixXd centres( model.stateDim, model.rbfs.size() );
+			for(size_t k=0;k<model.rbfs.size();++k) {
+				centres.col(k) = model.rbfs[k].centre;
+				weights.col(k) = model.rbfs[k].weight;
+			}
+			if( !model.rbfs.empty() ) func = model.rbfs[0].func;
+			grid.Build( centres, SupportRadius(func) );
+		}
+
+		VectorXd operator()( const VectorXd& x ) const {
+			VectorXd f = linear * x;
+			grid.Query( x, SupportRadius(func), [&]( uint32_t k, double r ) {
+				f.noalias() += weights.col(k) * func(r);
+			});
+			return f;
+		}
+
+		MatrixXd Partials( const VectorXd& x ) const {
+			MatrixXd J = linear;
+			grid.Query( x, SupportRadius(func), [&]( uint32_t k, double r ) {
+				if( r == 0.0 ) return;
+				J.noalias() += weights.col(k) * ( ( func.Derivative(r) / r ) * ( x - grid.points.col(k) ) ).transpose();
+			});
+			return J;
+		}
+
+		void EvaluateWithPartials( const VectorXd& x, VectorXd& f, MatrixXd& J ) const {
+			f.noalias() = linear * x;
+			J = linear;
+			double phi, dphi;
+			grid.Query( x, SupportRadius(func), [&]( uint32_t k, double r ) {
+				RadialValueGradient( func, r, phi, dphi );
+				f.noalias() += weights.col(k) * phi;
+				J.noalias() += weights.col(k) * ( dphi * ( x - grid.points.col(k) ) ).transpose();
+			});
+		}
+
+		/**
+		 * \brief The nonzero kernel entries of RBFModel::ComputeBasis at x.
+		 *
+		 * indices lists the kernels within reach of x, with their values phi and gradients as the
+		 * rows of grad.
+		 */
+		void ComputeLocalBasis( const VectorXd& x, vector<uint32_t>& indices, VectorXd& phi, MatrixXd& grad ) const {
+			indices.clear();
+			grid.Query( x, SupportRadius(func), [&]( uint32_t k, double ) {
+				indices.push_back(k);
+			});
+			phi.resize( indices.size() );
+			grad.resize( indices.size(), stateDim );
+			double dphi;
+			for(size_t i=0;i<indices.size();++i) {
+				auto r = x - grid.points.col( indices[i] );
+				RadialValueGradient( func, r.norm(), phi(i), dphi );
+				grad.row(i) = dphi * r.transpose();
+			}
+		}
+
+		/// As RBFModel::ComputeBasis, with zeros for the kernels out of reach
+		void ComputeBasis( const VectorXd& x, VectorXd& b, MatrixXd& Db ) const {
+			int64_t K = weights.cols();
+			b.setZero( stateDim + K );
+			Db.setZero( stateDim + K, stateDim );
+			b.head( stateDim ) = x;
+			Db.topRows( stateDim ).setIdentity();
+			vector<uint32_t> indices;
+			VectorXd phi;
+			MatrixXd grad;
+			ComputeLocalBasis( x, indices, phi, grad );
+			for(size_t i=0;i<indices.size();++i) {
+				b( stateDim + indices[i] ) = phi(i);
+				Db.row( stateDim + indices[i] ) = grad.row(i);
+			}
+		}
+	};
+
+	/// Compactly supported RBF models are evaluated through a CentreGrid, see LocalRBFModel
+	template<int K,typename Visitor>
+	auto DispatchDimension( const RBFModel<RBF<Wendland<K>>>& model, Visitor&& visit ) -> decltype( visit(model) ) {
+		return visit( LocalRBFModel<Wendland<K>>(model) );
+	}
+
+}
+
+#endif
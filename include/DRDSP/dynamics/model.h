@@ -3,6 +3,7 @@
 #include "embedding.h"
 #include "dynamicalSystem.h"
 #include <type_traits>
+#include <utility>
 
 namespace DRDSP {
 
@@ -32,6 +33,81 @@ namespace DRDSP {
 		Family( uint32_t stateDim, uint32_t paramDim ) : stateDim(stateDim), paramDim(paramDim) {}
 	};
 	
+	/**
+	 * \brief The linear part of a family, ComputeLinear(x) and ComputeLinearDerivative(x), for the
+	 * points of one fit.
+	 *
+	 * Families that share work between points, such as RBFFamily with an equivariant kernel,
+	 * specialize this to do that work once in the constructor. It refers to the family, so it must
+	 * not outlive it.
+	 */
+	template<typename F>
+	struct Linearization {
+		const F& family;
+
+		explicit Linearization( const F& family ) : family(family) {}
+
+		auto ComputeLinear( const VectorXd& x ) const -> decltype( std::declval<const F&>().ComputeLinear(x) ) {
+			return family.ComputeLinear(x);
+		}
+
+		auto ComputeLinearDerivative( const VectorXd& x ) const -> decltype( std::declval<const F&>().ComputeLinearDerivative(x) ) {
+			return family.ComputeLinearDerivative(x);
+		}
+	};
+
+	template<typename... Ts>
+	struct MakeVoid {
+		typedef void type;
+	};
+
+	/**
+	 * \brief True for models with a member EvaluateWithPartials( x, f, J ), which finds model(x) and
+	 * model.Partials(x) together, sharing the work common to both.
+	 */
+	template<typename M,typename = void>
+	struct HasEvaluateWithPartials : std::false_type {};
+
+	template<typename M>
+	struct HasEvaluateWithPartials<M,typename MakeVoid<decltype( &M::EvaluateWithPartials )>::type> : std::true_type {};
+
+	template<typename M,typename X,typename V,typename J>
+	void EvaluateWithPartials( const M& model, const X& x, V& f, J& partials, std::true_type ) {
+		model.EvaluateWithPartials( x, f, partials );
+	}
+
+	template<typename M,typename X,typename V,typename J>
+	void EvaluateWithPartials( const M& model, const X& x, V& f, J& partials, std::false_type ) {
+		f = model( x );
+		partials = model.Partials( x );
+	}
+
+	/// f = model(x) and partials = model.Partials(x), fused when the model has EvaluateWithPartials
+	template<typename M,typename X,typename V,typename J>
+	void EvaluateWithPartials( const M& model, const X& x, V& f, J& partials ) {
+		EvaluateWithPartials( model, x, f, partials, typename HasEvaluateWithPartials<M>::type() );
+	}
+
+	/**
+	 * \brief Calls visit with the model, or with a fixed-dimension copy of it for models that have one.
+	 *
+	 * See the overload for RBFModel.
+	 */
+	template<typename M,typename Visitor>
+	auto DispatchDimension( const M& model, Visitor&& visit ) -> decltype( visit(model) ) {
+		return visit( model );
+	}
+
+	/**
+	 * \brief True for families that are linear in their parameters with the parameters forming
+	 * a stateDim x m matrix P, so that the model is x -> P b(x) for a scalar basis b : R^n -> R^m.
+	 *
+	 * Their models provide ComputeBasis, so a BasisCache can be built and producers can then
+	 * solve for P with an m x m system instead of a paramDim x paramDim one.
+	 */
+	template<typename Family>
+	struct HasKroneckerStructure : std::false_type {};
+
 	/**
 	 * \brief A model without parameters whose state space is embedded into R^n.
 	 */
@@ -57,11 +133,13 @@ namespace DRDSP {
 		MatrixXd Partials( const State& state ) const {
 			MatrixXd result;
 			result.setZero(embedding.embedDim,embedding.sourceDim);
-			VectorXd vector = model(state);
+			VectorXd vector;
+			typename std::decay<decltype( model.Partials(state) )>::type partials;
+			EvaluateWithPartials( model, state, vector, partials );
 			for(uint32_t i=0;i<embedding.embedDim;++i) {
 				result.row(i) += embedding.Derivative2(state,i) * vector;
 			}
-			result += embedding.Derivative(state) * model.Partials(state);
+			result += embedding.Derivative(state) * partials;
 			return result;
 		}
 
@@ -0,0 +1,273 @@
+#ifndef INCLUDED_DYNAMICS_MODEL_EXPORT
+#define INCLUDED_DYNAMICS_MODEL_EXPORT
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include "rbf_family.h"
+#include "../eigen_affine.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Writes the body of Kernel( double r2, double& phi, double& dphi ) for a radial function.
+	 *
+	 * The generated function sets phi = phi(r) and dphi = phi'(r)/r at r^2 = r2, with dphi = 0 where
+	 * it is singular at r = 0, matching RadialValueGradient.
+	 */
+	template<typename R>
+	struct RadialCode;
+
+	template<>
+	struct RadialCode<Gaussian> {
+		static void Write( ostream& out, const Gaussian& f ) {
+			double s2 = f.scale * f.scale;
+			out << "\t\tphi = std::exp( -" << s2 << " * r2 );\n";
+			out << "\t\tdphi = -" << 2.0 * s2 << " * phi;\n";
+		}
+	};
+
+	template<>
+	struct RadialCode<Multiquadratic> {
+		static void Write( ostream& out, const Multiquadratic& f ) {
+			double s2 = f.scale * f.scale;
+			out << "\t\tphi = std::sqrt( 1.0 + " << s2 << " * r2 );\n";
+			out << "\t\tdphi = " << s2 << " / phi;\n";
+		}
+	};
+
+	template<>
+	struct RadialCode<InverseQuadratic> {
+		static void Write( ostream& out, const InverseQuadratic& f ) {
+			double s2 = f.scale * f.scale;
+			out << "\t\tphi = 1.0 / ( 1.0 + " << s2 << " * r2 );\n";
+			out << "\t\tdphi = -" << 2.0 * s2 << " * phi * phi;\n";
+		}
+	};
+
+	template<>
+	struct RadialCode<InverseMultiquadratic> {
+		static void Write( ostream& out, const InverseMultiquadratic& f ) {
+			double s2 = f.scale * f.scale;
+			out << "\t\tphi = 1.0 / std::sqrt( 1.0 + " << s2 << " * r2 );\n";
+			out << "\t\tdphi = -" << s2 << " * phi * phi * phi;\n";
+		}
+	};
+
+	/// r^N for odd N and r^N log(r) for even N
+	template<int N>
+	struct RadialCode<PolyharmonicSpline<N>> {
+		static void Write( ostream& out, const PolyharmonicSpline<N>& ) {
+			out << "\t\tdouble r = std::sqrt( r2 ), q = 1.0;\n";
+			out << "\t\tfor( int i = 2; i < " << N << "; ++i ) q *= r;\n";
+			if( N % 2 == 0 ) {
+				out << "\t\tif( r2 == 0.0 ) { phi = 0.0; dphi = 0.0; return; }\n";
+				out << "\t\tdouble L = std::log( r );\n";
+				out << "\t\tphi = q * r2 * L;\n";
+				out << "\t\tdphi = q * ( 1.0 + " << N << " * L );\n";
+			} else {
+				if( N == 1 ) {
+					out << "\t\tphi = r;\n";
+					out << "\t\tdphi = ( r2 == 0.0 ) ? 0.0 : 1.0 / r;\n";
+				} else {
+					out << "\t\tphi = q * r2;\n";
+					out << "\t\tdphi = " << N << " * q;\n";
+				}
+			}
+		}
+	};
+
+	template<int K>
+	struct RadialCode<Wendland<K>> {
+		static void Write( ostream& out, const Wendland<K>& f ) {
+			out << "\t\tdouble x = std::sqrt( r2 ) / " << f.radius << ";\n";
+			out << "\t\tif( x >= 1.0 ) { phi = 0.0; dphi = 0.0; return; }\n";
+			out << "\t\tdouble s = 1.0 - x;\n";
+			const double R2 = f.radius * f.radius;
+			switch( K ) {
+				case 0:
+					out << "\t\tphi = s * s;\n";
+					out << "\t\tdphi = ( x == 0.0 ) ? 0.0 : -2.0 * s / ( x * " << R2 << " );\n";
+					break;
+				case 1:
+					out << "\t\tphi = s * s * s * s * ( 4.0 * x + 1.0 );\n";
+					out << "\t\tdphi = -20.0 * s * s * s / " << R2 << ";\n";
+					break;
+				default:
+					out << "\t\tdouble s5 = s * s * s * s * s;\n";
+					out << "\t\tphi = s5 * s * ( 35.0 * x * x + 18.0 * x + 3.0 );\n";
+					out << "\t\tdphi = -56.0 * s5 * ( 5.0 * x + 1.0 ) / " << R2 << ";\n";
+			}
+		}
+	};
+
+	/// A double as a C++ literal that reads back exactly, in parentheses when negative
+	inline string CppLiteral( double x ) {
+		ostringstream s;
+		s.precision( numeric_limits<double>::max_digits10 );
+		if( x < 0.0 ) s << '(' << x << ')';
+		else s << x;
+		return s.str();
+	}
+
+	/// f +=/-= w phi and J +=/-= w dphi d^T for kernel k, with d = x - centre already set
+	inline void WriteKernelTerm( ostream& out, uint32_t k, int64_t n, const char* sign ) {
+		out << "\t\tKernel( ";
+		for(int64_t j=0;j<n;++j) {
+			out << ( j ? " + " : "" ) << "d[" << j << "] * d[" << j << "]";
+		}
+		out << ", phi, dphi );\n";
+		for(int64_t i=0;i<n;++i) {
+			out << "\t\tf[" << i << "] " << sign << "= c.weights[" << k << "][" << i << "] * phi;\n";
+		}
+		out << "\t\tif( J ) {\n";
+		for(int64_t i=0;i<n;++i) {
+			out << "\t\t\tg = c.weights[" << k << "][" << i << "] * dphi;\n";
+			for(int64_t j=0;j<n;++j) {
+				out << "\t\t\tJ[" << i << "][" << j << "] " << sign << "= g * d[" << j << "];\n";
+			}
+		}
+		out << "\t\t}\n";
+	}
+
+	/// Writes the terms of one kernel of an RBF or EquiRBFZ2 model at centre c
+	template<typename R>
+	struct KernelCode;
+
+	template<typename R,int Dim>
+	struct KernelCode<RBF<R,Dim>> {
+		typedef R RadialType;
+
+		static void Write( ostream& out, uint32_t k, const VectorXd& c ) {
+			const int64_t n = c.size();
+			out << "\t\t// Kernel " << k << "\n";
+			for(int64_t j=0;j<n;++j) {
+				out << "\t\td[" << j << "] = x[" << j << "] - " << CppLiteral( c(j) ) << ";\n";
+			}
+			WriteKernelTerm( out, k, n, "+" );
+		}
+	};
+
+	template<typename R,int Dim>
+	struct KernelCode<EquiRBFZ2<R,Dim>> {
+		typedef R RadialType;
+
+		static void Write( ostream& out, uint32_t k, const VectorXd& c ) {
+			const int64_t n = c.size();
+			out << "\t\t// Kernel " << k << ", w phi(|x-c|) - w phi(|x+c|)\n";
+			for(int64_t j=0;j<n;++j) {
+				out << "\t\td[" << j << "] = x[" << j << "] - " << CppLiteral( c(j) ) << ";\n";
+			}
+			WriteKernelTerm( out, k, n, "+" );
+			for(int64_t j=0;j<n;++j) {
+				out << "\t\td[" << j << "] = x[" << j << "] + " << CppLiteral( c(j) ) << ";\n";
+			}
+			WriteKernelTerm( out, k, n, "-" );
+		}
+	};
+
+	/**
+	 * \brief Writes a reduced family as a self-contained C++ header, for compiling into a simulator
+	 * without DRDSP.
+	 *
+	 * The header defines, in namespace name,
+	 * - stateDim, paramDim and numRBFs,
+	 * - Coefficients, holding the linear part and RBF weights of the model at one parameter,
+	 * - ComputeCoefficients( p, c ), the parameter map with its matrix inlined,
+	 * - Evaluate( c, x, f, J ), the model and optionally its Jacobian, with the centres inlined and
+	 *   the sum over kernels unrolled.
+	 *
+	 * Arrays are fixed-size and row-major. The kernels must be RBF or EquiRBFZ2, with the radial
+	 * function taken from the family's prototype.
+	 */
+	template<typename F>
+	void WriteCppHeader( const PMapFamily<RBFFamily<F>,AffineXd>& reduced, const char* filename, const char* name ) {
+		typedef typename KernelCode<F>::RadialType R;
+		ofstream out(filename);
+		if( !out ) {
+			cout << "WriteCppHeader : file error " << filename << endl;
+			return;
+		}
+		out.precision( numeric_limits<double>::max_digits10 );
+
+		const RBFFamily<F>& family = reduced.family;
+		const AffineXd& A = reduced.pmap;
+		const uint32_t n = family.stateDim;
+		const uint32_t K = (uint32_t)family.centres.size();
+		const uint32_t pdim = (uint32_t)A.linear.cols();
+
+		out << "// Generated by DRDSP WriteCppHeader, do not edit.\n";
+		out << "#pragma once\n";
+		out << "#include <cmath>\n\n";
+		out << "namespace " << name << " {\n\n";
+		out << "\tconst int stateDim = " << n << ";\n";
+		out << "\tconst int paramDim = " << pdim << ";\n";
+		out << "\tconst int numRBFs = " << K << ";\n\n";
+
+		out << "\t/// phi(r) and phi'(r)/r at r^2 = r2\n";
+		out << "\tinline void Kernel( double r2, double& phi, double& dphi ) {\n";
+		RadialCode<R>::Write( out, family.prototype.func );
+		out << "\t}\n\n";
+
+		out << "\t/// The model at one parameter, f(x) = linear x + sum_k weights[k] phi_k(x)\n";
+		out << "\tstruct Coefficients {\n";
+		out << "\t\tdouble linear[" << n << "][" << n << "];\n";
+		out << "\t\tdouble weights[" << std::max( K, 1u ) << "][" << n << "];\n";
+		out << "\t};\n\n";
+
+		// theta = A p + b, with linear(i,j) = theta(j n + i) and weights[k][i] = theta((k + n) n + i)
+		auto writeCoefficient = [&]( int64_t row ) {
+			out << CppLiteral( A.translation(row) );
+			for(uint32_t a=0;a<pdim;++a) {
+				if( A.linear(row,a) != 0.0 ) out << " + " << CppLiteral( A.linear(row,a) ) << " * p[" << a << "]";
+			}
+			out << ";\n";
+		};
+		out << "\tinline void ComputeCoefficients( const double p[" << std::max( pdim, 1u ) << "], Coefficients& c ) {\n";
+		if( pdim == 0 ) out << "\t\t(void)p;\n";
+		for(uint32_t i=0;i<n;++i) {
+			for(uint32_t j=0;j<n;++j) {
+				out << "\t\tc.linear[" << i << "][" << j << "] = ";
+				writeCoefficient( j * n + i );
+			}
+		}
+		for(uint32_t k=0;k<K;++k) {
+			for(uint32_t i=0;i<n;++i) {
+				out << "\t\tc.weights[" << k << "][" << i << "] = ";
+				writeCoefficient( ( k + n ) * n + i );
+			}
+		}
+		out << "\t}\n\n";
+
+		out << "\t/// f = model(x) and, if J is not null, J = df/dx\n";
+		out << "\tinline void Evaluate( const Coefficients& c, const double x[" << n << "], double f[" << n << "], double (*J)[" << n << "] = nullptr ) {\n";
+		out << "\t\tdouble d[" << n << "], phi, dphi, g;\n";
+		out << "\t\t(void)g;\n";
+		for(uint32_t i=0;i<n;++i) {
+			out << "\t\tf[" << i << "] = ";
+			for(uint32_t j=0;j<n;++j) {
+				out << ( j ? " + " : "" ) << "c.linear[" << i << "][" << j << "] * x[" << j << "]";
+			}
+			out << ";\n";
+		}
+		out << "\t\tif( J ) {\n";
+		for(uint32_t i=0;i<n;++i) {
+			for(uint32_t j=0;j<n;++j) {
+				out << "\t\t\tJ[" << i << "][" << j << "] = c.linear[" << i << "][" << j << "];\n";
+			}
+		}
+		out << "\t\t}\n";
+		for(uint32_t k=0;k<K;++k) {
+			KernelCode<F>::Write( out, k, family.centres[k] );
+		}
+		out << "\t}\n\n";
+		out << "}\n";
+	}
+
+}
+
+#endif
@@ -1,8 +1,15 @@
 #ifndef INCLUDED_DYNAMICS_MONODROMY
 #define INCLUDED_DYNAMICS_MONODROMY
 #include "../types.h"
+#include "../misc.h"
+#include "model.h"
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <limits>
 #include <Eigen/Eigenvalues>
+#include <Eigen/QR>
 
 using namespace std;
 
@@ -53,6 +60,105 @@ namespace DRDSP {
 		).eigenvalues();
 	}
 
+	/**
+	 * \brief True for models with a member DirectionalDerivative( x, V ), returning model.Partials(x) * V
+	 * without forming the Jacobian.
+	 */
+	template<typename M,typename = void>
+	struct HasDirectionalDerivative : std::false_type {};
+
+	template<typename M>
+	struct HasDirectionalDerivative<M,typename MakeVoid<decltype( &M::DirectionalDerivative )>::type> : std::true_type {};
+
+	template<typename Model>
+	MatrixXd DirectionalDerivative( const Model& model, const VectorXd& x, const MatrixXd& V, std::true_type ) {
+		return model.DirectionalDerivative( x, V );
+	}
+
+	/// Central differences of the model along each column of V, two evaluations per column
+	template<typename Model>
+	MatrixXd DirectionalDerivative( const Model& model, const VectorXd& x, const MatrixXd& V, std::false_type ) {
+		const double scale = std::cbrt( numeric_limits<double>::epsilon() ) * std::max( 1.0, x.lpNorm<Infinity>() );
+		MatrixXd D( V.rows(), V.cols() );
+		for(int64_t j=0;j<V.cols();++j) {
+			double vnorm = V.col(j).lpNorm<Infinity>();
+			if( vnorm == 0.0 ) {
+				D.col(j).setZero();
+				continue;
+			}
+			double h = scale / vnorm;
+			D.col(j) = ( model( x + h * V.col(j) ) - model( x - h * V.col(j) ) ) / ( 2.0 * h );
+		}
+		return D;
+	}
+
+	/// model.Partials(x) * V, matrix-free unless the model provides DirectionalDerivative
+	template<typename Model>
+	MatrixXd DirectionalDerivative( const Model& model, const VectorXd& x, const MatrixXd& V ) {
+		return DirectionalDerivative( model, x, V, typename HasDirectionalDerivative<Model>::type() );
+	}
+
+	/**
+	 * \brief V = M V for the monodromy matrix M of ComputeMonodromy, without forming M.
+	 *
+	 * Each column follows the variational equation along the samples with the same Euler steps,
+	 * v += dt J(x) v, using DirectionalDerivative. The columns are split between threads.
+	 */
+	template<typename Model>
+	void ApplyMonodromy( const Model& model, const vector<VectorXd>& samples, double dt, MatrixXd& V, uint32_t numThreads = 1 ) {
+		ParallelRanges( (size_t)V.cols(), numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+			MatrixXd block = V.middleCols( begin, end - begin );
+			for( const auto& x : samples ) {
+				block += dt * DirectionalDerivative( model, x, block );
+			}
+			V.middleCols( begin, end - begin ) = block;
+		});
+	}
+
+	/**
+	 * \brief The count multipliers of largest modulus, by subspace iteration on the period map.
+	 *
+	 * A block of count + extra orthonormal vectors is mapped by ApplyMonodromy and
+	 * re-orthonormalized, and the multipliers are the eigenvalues of the projection of the
+	 * monodromy matrix onto the block. Iteration stops when each of the leading count eigenpairs
+	 * satisfies M v = lambda v to within tolerance, relative to the largest multiplier.
+	 *
+	 * Each iteration is one pass along the orbit for the block, needing two model evaluations, or
+	 * one DirectionalDerivative, per vector and sample, and the monodromy matrix is never formed.
+	 * The extra vectors speed up convergence when multipliers are close in modulus.
+	 */
+	template<typename Model>
+	VectorXcd ComputeLeadingFloquetMultipliers( const Model& model, const vector<VectorXd>& samples, double dt, uint32_t count, uint32_t numThreads = 1, double tolerance = 1.0e-8, uint32_t maxIterations = 200, uint32_t extra = 4 ) {
+		const int64_t n = model.stateDim;
+		const int64_t p = std::min<int64_t>( n, count + extra );
+		count = (uint32_t)std::min<int64_t>( count, p );
+
+		MatrixXd Q = HouseholderQR<MatrixXd>( MatrixXd::Random( n, p ) ).householderQ() * MatrixXd::Identity( n, p );
+		MatrixXd Z;
+		VectorXcd multipliers( count );
+		vector<int64_t> order( p );
+		for(uint32_t iter=0;iter<maxIterations;++iter) {
+			Z = Q;
+			ApplyMonodromy( model, samples, dt, Z, numThreads );
+			EigenSolver<MatrixXd> eigen( Q.transpose() * Z );
+			const VectorXcd& values = eigen.eigenvalues();
+			iota( order.begin(), order.end(), 0 );
+			sort( order.begin(), order.end(), [&]( int64_t a, int64_t b ) { return abs( values(a) ) > abs( values(b) ); } );
+
+			// Converged when M (Q y) = lambda (Q y) holds to tolerance for each leading Ritz pair
+			MatrixXcd Y = eigen.eigenvectors();
+			MatrixXcd ZY = Z * Y, QY = Q * Y;
+			double residual = 0.0;
+			for(uint32_t i=0;i<count;++i) {
+				multipliers(i) = values( order[i] );
+				residual = std::max( residual, ( ZY.col( order[i] ) - multipliers(i) * QY.col( order[i] ) ).norm() / QY.col( order[i] ).norm() );
+			}
+			if( residual <= tolerance * std::max( 1.0, abs( multipliers(0) ) ) ) break;
+			Q = HouseholderQR<MatrixXd>( Z ).householderQ() * MatrixXd::Identity( n, p );
+		}
+		return multipliers;
+	}
+
 }
 
 #endif
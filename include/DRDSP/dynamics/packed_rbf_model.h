@@ -0,0 +1,222 @@
+#ifndef INCLUDED_DYNAMICS_PACKED_RBF_MODEL
+#define INCLUDED_DYNAMICS_PACKED_RBF_MODEL
+#include <cmath>
+#include "rbf_model.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief phi(r) and phi'(r)/r for an array of squared distances r2.
+	 *
+	 * The gradient of x -> phi(|x-c|) is then dphi (x-c). The general version calls the scalar
+	 * radial function for each distance, and the specializations use whole-array operations.
+	 * Where phi'(r)/r is singular at r = 0 it is set to zero, since x - c is zero there.
+	 */
+	template<typename R>
+	struct PackedKernel {
+		static void Evaluate( const R& func, const ArrayXd& r2, ArrayXd& phi, ArrayXd& dphi ) {
+			phi.resize( r2.size() );
+			dphi.resize( r2.size() );
+			for(int64_t k=0;k<r2.size();++k) {
+				double r = std::sqrt( r2(k) );
+				phi(k) = func( r );
+				dphi(k) = ( r == 0.0 ) ? 0.0 : func.Derivative( r ) / r;
+			}
+		}
+	};
+
+	template<>
+	struct PackedKernel<Gaussian> {
+		static void Evaluate( const Gaussian& func, const ArrayXd& r2, ArrayXd& phi, ArrayXd& dphi ) {
+			double s2 = func.scale * func.scale;
+			phi = ( -s2 * r2 ).exp();
+			dphi = ( -2.0 * s2 ) * phi;
+		}
+	};
+
+	template<>
+	struct PackedKernel<Multiquadratic> {
+		static void Evaluate( const Multiquadratic& func, const ArrayXd& r2, ArrayXd& phi, ArrayXd& dphi ) {
+			double s2 = func.scale * func.scale;
+			phi = ( 1.0 + s2 * r2 ).sqrt();
+			dphi = s2 * phi.inverse();
+		}
+	};
+
+	template<>
+	struct PackedKernel<InverseQuadratic> {
+		static void Evaluate( const InverseQuadratic& func, const ArrayXd& r2, ArrayXd& phi, ArrayXd& dphi ) {
+			double s2 = func.scale * func.scale;
+			phi = ( 1.0 + s2 * r2 ).inverse();
+			dphi = ( -2.0 * s2 ) * phi.square();
+		}
+	};
+
+	template<>
+	struct PackedKernel<InverseMultiquadratic> {
+		static void Evaluate( const InverseMultiquadratic& func, const ArrayXd& r2, ArrayXd& phi, ArrayXd& dphi ) {
+			double s2 = func.scale * func.scale;
+			phi = ( 1.0 + s2 * r2 ).sqrt().inverse();
+			dphi = -s2 * phi.cube();
+		}
+	};
+
+	/// r^N for odd N and r^N log(r) for even N
+	template<int N>
+	struct PackedKernel<PolyharmonicSpline<N>> {
+		static void Evaluate( const PolyharmonicSpline<N>&, const ArrayXd& r2, ArrayXd& phi, ArrayXd& dphi ) {
+			phi.resize( r2.size() );
+			dphi.resize( r2.size() );
+			for(int64_t k=0;k<r2.size();++k) {
+				double s = r2(k), q = 1.0;
+				if( N % 2 == 0 ) {
+					for(int i=1;i<N/2;++i) q *= s;        // r^(N-2)
+					double L = ( s > 0.0 ) ? log(s) : 0.0;  // 2 log(r)
+					phi(k) = 0.5 * q * s * L;
+					dphi(k) = q * ( 1.0 + ( 0.5 * N ) * L );
+				} else {
+					double r = std::sqrt(s);
+					if( N == 1 ) {
+						phi(k) = r;
+						dphi(k) = ( s > 0.0 ) ? 1.0 / r : 0.0;
+						continue;
+					}
+					for(int i=3;i<N;i+=2) q *= s;         // r^(N-3)
+					phi(k) = q * s * r;
+					dphi(k) = double(N) * q * r;
+				}
+			}
+		}
+	};
+
+	/**
+	 * \brief An RBFModel with RBF<R> kernels, stored as d x K matrices of centres and weights.
+	 *
+	 * The matrices are row-major, so each coordinate is contiguous over the kernels. Evaluating
+	 * the model finds the K distances with vector operations along the rows, applies the kernel to
+	 * all of them with PackedKernel, and sums the weights with a single product. The value and the
+	 * Jacobian can be found together with EvaluateWithPartials.
+	 *
+	 * The radial function is shared by all kernels and is taken from the first RBF of the model.
+	 */
+	template<typename R,int Dim = Dynamic>
+	struct PackedRBFModel : Model<Matrix<double,Dim,1>> {
+		typedef Matrix<double,Dim,1> VectorType;
+		typedef Matrix<double,Dim,Dim> MatrixType;
+		typedef Matrix<double,Dim,Dynamic,RowMajor> PackedType;
+		using Model<VectorType>::stateDim;
+
+		MatrixType linear;
+		PackedType centres,  ///< Column k is the centre of kernel k
+		           weights;  ///< Column k is the weight of kernel k
+		R func;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW_IF_VECTORIZABLE_FIXED_SIZE(double,Dim)
+
+		PackedRBFModel() = default;
+
+		template<int D>
+		explicit PackedRBFModel( const RBFModel<RBF<R>,D>& model ) :
+			Model<VectorType>(model.stateDim),
+			linear(model.linear),
+			centres(model.stateDim,model.rbfs.size()),
+			weights(model.stateDim,model.rbfs.size())
+		{
+			for(size_t k=0;k<model.rbfs.size();++k) {
+				centres.col(k) = model.rbfs[k].centre;
+				weights.col(k) = model.rbfs[k].weight;
+			}
+			if( !model.rbfs.empty() ) func = model.rbfs[0].func;
+		}
+
+		VectorType operator()( const VectorType& x ) const {
+			Workspace& w = ComputeKernels( x );
+			VectorType f = linear * x;
+			f.noalias() += weights * w.phi.matrix();
+			return f;
+		}
+
+		MatrixType Partials( const VectorType& x ) const {
+			Workspace& w = ComputeKernels( x );
+			MatrixType J = linear;
+			AddJacobian( w, J );
+			return J;
+		}
+
+		/// The value f and the Jacobian J at x, from one evaluation of the kernels
+		void EvaluateWithPartials( const VectorType& x, VectorType& f, MatrixType& J ) const {
+			Workspace& w = ComputeKernels( x );
+			f.noalias() = linear * x;
+			f.noalias() += weights * w.phi.matrix();
+			J = linear;
+			AddJacobian( w, J );
+		}
+
+		/// As RBFModel::ComputeBasis
+		void ComputeBasis( const VectorType& x, VectorXd& b, MatrixXd& Db ) const {
+			Workspace& w = ComputeKernels( x );
+			int64_t K = centres.cols();
+			b.resize( stateDim + K );
+			Db.resize( stateDim + K, stateDim );
+			b.head( stateDim ) = x;
+			b.tail( K ) = w.phi.matrix();
+			Db.topRows( stateDim ).setIdentity();
+			Db.bottomRows( K ).noalias() = w.dphi.matrix().asDiagonal() * w.diff.transpose();
+		}
+
+	protected:
+
+		/// Per-thread buffers, so an evaluation does not allocate once they have grown to size
+		struct Workspace {
+			PackedType diff,   ///< Column k is x - centre k
+			           scaled; ///< Column k is dphi_k weight_k
+			ArrayXd r2, phi, dphi;
+		};
+
+		/// J += sum_k dphi_k weight_k (x - centre_k)^T, as dot products along the rows
+		void AddJacobian( Workspace& w, MatrixType& J ) const {
+			w.scaled.resize( stateDim, centres.cols() );
+			for(uint32_t i=0;i<stateDim;++i) {
+				w.scaled.row(i) = weights.row(i).cwiseProduct( w.dphi.matrix().transpose() );
+			}
+			for(uint32_t i=0;i<stateDim;++i) {
+				for(uint32_t j=0;j<stateDim;++j) {
+					J(i,j) += w.scaled.row(i).dot( w.diff.row(j) );
+				}
+			}
+		}
+
+		/// The distances and kernels at x, with dphi = phi'(r)/r
+		Workspace& ComputeKernels( const VectorType& x ) const {
+			static thread_local Workspace w;
+			w.diff = ( -centres ).colwise() + x;
+			w.r2.setZero( centres.cols() );
+			for(uint32_t j=0;j<stateDim;++j) {
+				w.r2 += w.diff.row(j).transpose().array().square();
+			}
+			PackedKernel<R>::Evaluate( func, w.r2, w.phi, w.dphi );
+			return w;
+		}
+	};
+
+	/**
+	 * \brief Calls visit with the model packed, at its fixed dimension up to maxFixedDimension.
+	 *
+	 * visit must return the same type for every dimension.
+	 */
+	template<typename R,typename Visitor>
+	auto DispatchDimension( const RBFModel<RBF<R>>& model, Visitor&& visit ) -> decltype( visit(model) ) {
+		switch( model.stateDim ) {
+			case 1: return visit( PackedRBFModel<R,1>(model) );
+			case 2: return visit( PackedRBFModel<R,2>(model) );
+			case 3: return visit( PackedRBFModel<R,3>(model) );
+			case 4: return visit( PackedRBFModel<R,4>(model) );
+			default: return visit( PackedRBFModel<R>(model) );
+		}
+	}
+
+}
+
+#endif
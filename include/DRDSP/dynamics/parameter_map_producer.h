@@ -4,8 +4,20 @@
 #include "reduced_data_system.h"
 #include "../eigen_affine.h"
 #include "../misc.h"
+#include "../least_squares.h"
+#include "sparse_basis_cache.h"
+#include <algorithm>
 #include <cmath>
 #include <Eigen/LU>
+#include <Eigen/SparseCholesky>
+
+#pragma warning( disable : 4510 ) // default constructor could not be generated
+#pragma warning( disable : 4610 ) // can never be instantiated - user defined constructor required
+
+#include <Eigen/SVD>
+
+#pragma warning( default : 4610 )
+#pragma warning( default : 4510 )
 
 using namespace std;
 
@@ -18,20 +30,121 @@ namespace DRDSP {
 			return VecToAffine( ComputeParameterMap( family, data, parameters ), family.paramDim );
 		}
 
-		AffineXd SolveOrig( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
-			MatrixXd A, Atemp;
-			VectorXd B, Btemp;
-			uint64_t pdim = parameters[0].size();
-			uint64_t m = family.paramDim * ( pdim + 1 );
+		/// Uses SolveSparse or SolveKronecker when the family allows it, otherwise SolveOrig
+		AffineXd Solve( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
+			return Solve( family, data, parameters, typename HasKroneckerStructure<Family>::type() );
+		}
 
-			A.setZero(m,m);
-			B.setZero(m);
+		/**
+		 * \brief Solves the same least squares problem as SolveOrig for families with HasKroneckerStructure.
+		 *
+		 * With c = [p;1] and the coefficients at p given by P(p) = sum_j c_j Q_j, the normal equations are
+		 * Q ( sum c c^T (x) G_p ) = sum c^T (x) R_p, a system of size m(pdim+1) rather than paramDim(pdim+1).
+		 */
+		AffineXd SolveKronecker( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
+			BasisCache cache;
+			cache.Compute( family, data );
+			return SolveKronecker( cache, parameters );
+		}
 
-			for(uint32_t i=0;i<data.numParameters;++i) {
-				ComputeMatrices( Atemp, Btemp, family, data.reducedData[i], parameters[i] );
-				A += Atemp;
-				B += Btemp;
+		AffineXd SolveKronecker( const BasisCache& cache, const vector<VectorXd>& parameters ) const {
+			MatrixXd Gbig, Rbig;
+			ComputeKroneckerSystem( cache, parameters, Gbig, Rbig );
+			Eigen::FullPivLU<MatrixXd> lu(Gbig);
+			MatrixXd Q = lu.solve( Rbig.transpose() ).transpose();
+			return VecToAffine( Vectorize(Q), cache.dimension * cache.basisDim );
+		}
+
+		/// The system Q Gbig = Rbig solved by SolveKronecker
+		void ComputeKroneckerSystem( const BasisCache& cache, const vector<VectorXd>& parameters, MatrixXd& Gbig, MatrixXd& Rbig ) const {
+			int64_t dim = cache.dimension;
+			int64_t m = cache.basisDim;
+			int64_t pdim = parameters[0].size();
+			int64_t n = m * ( pdim + 1 );
+			MatrixXd G, R;
+			VectorXd c( pdim + 1 );
+
+			Gbig.setZero( n, n );
+			Rbig.setZero( dim, n );
+
+			for(size_t i=0;i<cache.entries.size();++i) {
+				const BasisCache::Entry& e = cache.entries[i];
+				cache.ComputeGram( e, fitWeight[0]/e.scales[0], fitWeight[1]/e.scales[1], G, R );
+				c << parameters[i], 1.0;
+				for(int64_t a=0;a<=pdim;++a) {
+					for(int64_t b=0;b<=pdim;++b) {
+						Gbig.block(a*m,b*m,m,m) += ( c(a) * c(b) ) * G;
+					}
+					Rbig.middleCols(a*m,m) += c(a) * R;
+				}
 			}
+		}
+
+		/**
+		 * \brief SolveKronecker for families with HasSparseBasis, such as RBFFamily<RBF<Wendland<K>>>.
+		 *
+		 * The system Q Gbig = Rbig is assembled from the sparse Gram matrices of a SparseBasisCache and
+		 * solved with a sparse LDLT factorization. If that fails, for example when there are fewer data
+		 * sets than parameter dimensions plus one, it falls back to the dense FullPivLU.
+		 */
+		AffineXd SolveSparse( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
+			SparseBasisCache cache;
+			cache.Compute( family, data );
+			return SolveSparse( cache, parameters );
+		}
+
+		AffineXd SolveSparse( const SparseBasisCache& cache, const vector<VectorXd>& parameters ) const {
+			SparseMatrix<double> Gbig;
+			MatrixXd Rbig, Q;
+			ComputeSparseSystem( cache, parameters, Gbig, Rbig );
+			SimplicialLDLT<SparseMatrix<double>> ldlt( Gbig );
+			if( ldlt.info() == Success ) {
+				Q = ldlt.solve( Rbig.transpose() ).transpose();
+			}
+			if( ldlt.info() != Success || !Q.allFinite() ) {
+				Q = Eigen::FullPivLU<MatrixXd>( MatrixXd(Gbig) ).solve( Rbig.transpose() ).transpose();
+			}
+			return VecToAffine( Vectorize(Q), cache.dimension * cache.basisDim );
+		}
+
+		/// The sparse version of ComputeKroneckerSystem
+		void ComputeSparseSystem( const SparseBasisCache& cache, const vector<VectorXd>& parameters, SparseMatrix<double>& Gbig, MatrixXd& Rbig ) const {
+			typedef Triplet<double> T;
+			int64_t dim = cache.dimension;
+			int64_t m = cache.basisDim;
+			int64_t pdim = parameters[0].size();
+			int64_t n = m * ( pdim + 1 );
+			SparseMatrix<double> G;
+			MatrixXd R;
+			VectorXd c( pdim + 1 );
+			vector<T> triplets;
+
+			Rbig.setZero( dim, n );
+
+			for(size_t i=0;i<cache.entries.size();++i) {
+				const SparseBasisCache::Entry& e = cache.entries[i];
+				cache.ComputeGram( e, fitWeight[0]/e.scales[0], fitWeight[1]/e.scales[1], G, R );
+				c << parameters[i], 1.0;
+				for(int64_t a=0;a<=pdim;++a) {
+					for(int64_t b=0;b<=pdim;++b) {
+						double cab = c(a) * c(b);
+						for(int64_t k=0;k<G.outerSize();++k) {
+							for(SparseMatrix<double>::InnerIterator it(G,k);it;++it) {
+								triplets.emplace_back( (int)( a*m + it.row() ), (int)( b*m + it.col() ), cab * it.value() );
+							}
+						}
+					}
+					Rbig.middleCols(a*m,m) += c(a) * R;
+				}
+			}
+			Gbig.resize( n, n );
+			Gbig.setFromTriplets( triplets.begin(), triplets.end() );
+		}
+
+		AffineXd SolveOrig( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
+			MatrixXd A;
+			VectorXd B;
+			ComputeSystem( A, B, family, data, parameters );
 
 			Eigen::FullPivLU<MatrixXd> lu(A);
 			if( !lu.isInjective() ) {
@@ -43,79 +156,110 @@ namespace DRDSP {
 
 	protected:
 
-		void ComputeMatrices( MatrixXd& A, VectorXd& B, const Family& family, const ReducedData& data, const VectorXd& parameter ) const {
-			MatrixXd A1, A2;
-			VectorXd y1, y2;
-			uint32_t ldim = family.paramDim;
-			uint32_t dim = data.dimension;
-			uint32_t dim2 = dim*dim;
+		AffineXd Solve( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters, std::true_type ) {
+			return SolveScalar( family, data, parameters, typename HasSparseBasis<Family>::type() );
+		}
 
-			A1.setZero( data.count * dim, ldim );
-			y1.setZero( data.count * dim );
-			y2.setZero( data.count * dim2 );
-			A2.setZero( data.count * dim2, ldim );
+		AffineXd SolveScalar( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters, std::true_type ) {
+			return SolveSparse( family, data, parameters );
+		}
 
-			for(size_t i=0;i<data.count;++i) {
-				A1.block(i*dim,0,dim,ldim) = family.ComputeLinear( data.points[i] );
-			}
-			for(size_t i=0;i<data.count;++i) {
-				y1.segment(i*dim,dim) = data.vectors[i] - family.ComputeTranslation( data.points[i] );
-			}
-			for(size_t i=0;i<data.count;++i) {
-				A2.block(i*dim2,0,dim2,ldim) = family.ComputeLinearDerivative( data.points[i] );
-			}
-			for(size_t i=0;i<data.count;++i) {
-				y2.segment(i*dim2,dim2) = Vectorize( data.derivatives[i] - family.ComputeTranslationDerivative( data.points[i] ) );
-			}
-			
-			auto Y = A1.transpose() * y1 * (fitWeight[0]/data.scales[0]) + A2.transpose() * y2 * (fitWeight[1]/data.scales[1]);
-			auto X = A1.transpose() * A1 * (fitWeight[0]/data.scales[0]) + A2.transpose() * A2 * (fitWeight[1]/data.scales[1]);
-			auto D = ComputeD(parameter,ldim);
+		AffineXd SolveScalar( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters, std::false_type ) {
+			return SolveKronecker( family, data, parameters );
+		}
 
-			B = D.transpose() * Y;
-			A = D.transpose() * X * D;
+		AffineXd Solve( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters, std::false_type ) {
+			return SolveOrig( family, data, parameters );
 		}
 
-		VectorXd ComputeParameterMap( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
-			MatrixXd linear, linearD, D, LHS, BD, CD, transD;
-			VectorXd trans, RHS;
-			size_t N = data.TotalPoints();
+		void ComputeSystem( MatrixXd& A, VectorXd& B, const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) const {
+			MatrixXd Atemp;
+			VectorXd Btemp;
+			uint64_t pdim = parameters[0].size();
+			uint64_t m = family.paramDim * ( pdim + 1 );
 
-			LHS.setZero(
-				N * data.reducedData[0].dimension * (1 + data.reducedData[0].dimension),
-				family.paramDim * ( parameters[0].size() + 1 )
-			);
-			RHS.setZero( LHS.rows() );
+			A.setZero(m,m);
+			B.setZero(m);
 
-			int64_t k1 = 0, k2 = 0;
+			Linearization<Family> linear( family );
 			for(uint32_t i=0;i<data.numParameters;++i) {
-				D = ComputeD( parameters[i], family.paramDim );
-
-				double scale = std::sqrt( fitWeight[0] / data.reducedData[i].scales[0] );
-				double scaleD = std::sqrt( fitWeight[1] / data.reducedData[i].scales[1] );
-
-				for(uint32_t j=0;j<data.reducedData[i].count;++j) {
-					const VectorXd& x = data.reducedData[i].points[j];
-					linear = family.ComputeLinear( x );
-					trans = family.ComputeTranslation( x );
-					const VectorXd& V = data.reducedData[i].vectors[j];
-					LHS.block(k1,0,linear.rows(),D.cols()) = linear * D * scale;
-					RHS.segment(k2,V.size()) = (V - trans) * scale;
-					k1 += linear.rows();
-					k2 += V.size();
+				ComputeMatrices( Atemp, Btemp, linear, data.reducedData[i], parameters[i] );
+				A += Atemp;
+				B += Btemp;
+			}
+		}
+
+		void ComputeMatrices( MatrixXd& A, VectorXd& B, const Linearization<Family>& linear, const ReducedData& data, const VectorXd& parameter ) const {
+			uint32_t ldim = linear.family.paramDim;
+			NormalEquations eq = ComputeNormalEquations( linear, data );
+			MatrixXd D = ComputeD(parameter,ldim);
+
+			B.noalias() = D.transpose() * eq.Aty;
+			A.noalias() = D.transpose() * eq.Matrix() * D;
+		}
+
+		/// The normal equations of one data set, in the coefficients of the family before D(p) is applied
+		NormalEquations ComputeNormalEquations( const Family& family, const ReducedData& data ) const {
+			return ComputeNormalEquations( Linearization<Family>( family ), data );
+		}
+
+		NormalEquations ComputeNormalEquations( const Linearization<Family>& linear, const ReducedData& data ) const {
+			const Family& family = linear.family;
+			uint32_t ldim = family.paramDim;
+			double w1 = fitWeight[0] / data.scales[0];
+			double w2 = fitWeight[1] / data.scales[1];
+
+			return AccumulateNormalEquations( ldim, data.count, fitThreads,
+				[&]( NormalEquations& partial, size_t i ) {
+					const VectorXd& x = data.points[i];
+					partial.Add( linear.ComputeLinear(x), data.vectors[i] - family.ComputeTranslation(x), w1 );
+					partial.Add( linear.ComputeLinearDerivative(x), Vectorize( data.derivatives[i] - family.ComputeTranslationDerivative(x) ), w2 );
 				}
-				for(uint32_t j=0;j<data.reducedData[i].count;++j) {
-					const VectorXd& x = data.reducedData[i].points[j];
-					linearD = family.ComputeLinearDerivative( x );
-					transD = family.ComputeTranslationDerivative( x );
-					const MatrixXd& dV = data.reducedData[i].derivatives[j];
-					LHS.block(k1,0,linearD.rows(),D.cols()) = linearD * D * scaleD;
-					RHS.segment(k2,dV.size()) = Vectorize(dV - transD) * scaleD;
-					k1 += linearD.rows();
-					k2 += dV.size();
+			);
+		}
+
+		/**
+		 * \brief Solves the least squares problem of the whole system by a parallel TSQR.
+		 *
+		 * The rows L(x) D(p) of every point of every data set are factorized in blocks, one range of
+		 * points per thread, and the triangular factors are merged in a tree (AccumulateTSQR).
+		 * The final factor is solved with an SVD, which tolerates rank deficiency. Unlike solving the
+		 * normal equations of ComputeSystem, this does not square the condition number.
+		 */
+		VectorXd ComputeParameterMap( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) {
+			const int64_t ldim = family.paramDim;
+			const int64_t q = parameters[0].size() + 1;
+
+			vector<size_t> offsets( data.numParameters + 1, 0 );
+			vector<VectorXd> c( data.numParameters, VectorXd(q) );
+			for(uint32_t j=0;j<data.numParameters;++j) {
+				offsets[j+1] = offsets[j] + data.reducedData[j].count;
+				c[j] << parameters[j], 1.0;
+			}
+
+			Linearization<Family> linear( family );
+			TallSkinnyQR qr = AccumulateTSQR( ldim * q, offsets.back(), fitThreads,
+				[&]( TallSkinnyQR& partial, size_t k ) {
+					size_t j = size_t( upper_bound( offsets.begin(), offsets.end(), k ) - offsets.begin() ) - 1;
+					const ReducedData& rd = data.reducedData[j];
+					const VectorXd& x = rd.points[k - offsets[j]];
+					double w1 = fitWeight[0] / rd.scales[0];
+					double w2 = fitWeight[1] / rd.scales[1];
+					partial.Add( ComputeRows( linear.ComputeLinear(x), c[j] ), rd.vectors[k - offsets[j]] - family.ComputeTranslation(x), w1 );
+					partial.Add( ComputeRows( linear.ComputeLinearDerivative(x), c[j] ), Vectorize( rd.derivatives[k - offsets[j]] - family.ComputeTranslationDerivative(x) ), w2 );
 				}
+			);
+			return qr.Solve();
+		}
+
+		/// L D(p) = [ c_1 L, ..., c_q L ] with c = [p;1], without forming D
+		static MatrixXd ComputeRows( const MatrixXd& L, const VectorXd& c ) {
+			const int64_t ldim = L.cols();
+			MatrixXd rows( L.rows(), ldim * c.size() );
+			for(int64_t a=0;a<c.size();++a) {
+				rows.middleCols( a * ldim, ldim ) = c(a) * L;
 			}
-			return JacobiSVD<MatrixXd>(LHS,ComputeThinU|ComputeThinV).solve(RHS);
+			return rows;
 		}
 
 		static MatrixXd ComputeD( const VectorXd& parameter, int64_t ldim ) {
@@ -34,10 +34,12 @@ namespace DRDSP {
 	struct PolyharmonicSpline<2> {
 		template<typename T>
 		T operator()( T r ) const {
+			if( r == T(0) ) return T(0);
 			return r * r * log(r);
 		}
 		template<typename T>
 		T Derivative( T r ) const {
+			if( r == T(0) ) return T(0);
 			return r * ( T(1) + T(2) * log(r) );
 		}
 	};
@@ -60,11 +62,13 @@ namespace DRDSP {
 	struct PolyharmonicSpline<4> {
 		template<typename T>
 		T operator()( T r ) const {
+			if( r == T(0) ) return T(0);
 			T r2 = r * r;
 			return r2 * r2 * log(r);
 		}
 		template<typename T>
 		T Derivative( T r ) const {
+			if( r == T(0) ) return T(0);
 			T r2 = r * r;
 			return r2 * r * ( T(1) + T(4) * log(r) );
 		}
@@ -88,11 +92,13 @@ namespace DRDSP {
 	struct PolyharmonicSpline<6> {
 		template<typename T>
 		T operator()( T r ) const {
+			if( r == T(0) ) return T(0);
 			T r3 = r * r * r;
-			return r3 * r3;
+			return r3 * r3 * log(r);
 		}
 		template<typename T>
 		T Derivative( T r ) const {
+			if( r == T(0) ) return T(0);
 			T r2 = r * r;
 			return r2 * r2 * r * ( T(1) + T(6) * log(r) );
 		}
@@ -116,12 +122,14 @@ namespace DRDSP {
 	struct PolyharmonicSpline<8> {
 		template<typename T>
 		T operator()( T r ) const {
+			if( r == T(0) ) return T(0);
 			T r2 = r * r;
 			T r4 = r2 * r2;
-			return r4 * r4;
+			return r4 * r4 * log(r);
 		}
 		template<typename T>
 		T Derivative( T r ) const {
+			if( r == T(0) ) return T(0);
 			T r3 = r * r * r;
 			return r3 * r3 * r * ( T(1) + T(8) * log(r) );
 		}
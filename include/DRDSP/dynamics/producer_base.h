@@ -1,32 +1,87 @@
 #ifndef INCLUDED_DYNAMICS_PRODUCER_BASE
 #define INCLUDED_DYNAMICS_PRODUCER_BASE
 #include "reduced_data_system.h"
+#include "basis_cache.h"
+#include "sparse_basis_cache.h"
+#include "model.h"
+#include "../eigen_affine.h"
 
 namespace DRDSP {
 
 	struct ProducerBase {
 		double fitWeight[2];
+		uint32_t fitThreads = 1;  ///< Threads used to accumulate the normal equations of a single fit
 
 		ProducerBase() {
 			fitWeight[0] = 0.5;
 			fitWeight[1] = 0.5;
 		}
 
+		/// The cost of the model on one data set, evaluated at the model's fixed dimension if it has one
 		template<typename Model>
 		double ComputeTotalCost( const Model& model, const ReducedData& data ) const {
-			double S1 = 0.0;
-			for(uint32_t i=0;i<data.count;++i) {
-				S1 += ( model(data.points[i]) - data.vectors[i] ).squaredNorm();
+			return DispatchDimension( model, [&]( const auto& m ) {
+				return ComputeModelCost( m, data );
+			});
+		}
+
+		/**
+		 * \brief Adds scale times the cost of model on data to total, point by point.
+		 *
+		 * Returns false, leaving a partial sum in total, as soon as total exceeds bound.
+		 */
+		template<typename Model>
+		bool AddCost( const Model& model, const ReducedData& data, double scale, double& total, double bound ) const {
+			return DispatchDimension( model, [&]( const auto& m ) {
+				return AddModelCost( m, data, scale, total, bound );
+			});
+		}
+
+		/// The cost of the model with coefficients P = [linear, w_1, ..., w_K] on one cached data set
+		double ComputeTotalCost( const MatrixXd& P, const BasisCache& cache, const BasisCache::Entry& entry ) const {
+			return cache.ComputeCost( entry, P, fitWeight[0]/entry.scales[0], fitWeight[1]/entry.scales[1] );
+		}
+
+		double ComputeTotalCost( const MatrixXd& P, const SparseBasisCache& cache, const SparseBasisCache::Entry& entry ) const {
+			return cache.ComputeCost( entry, P, fitWeight[0]/entry.scales[0], fitWeight[1]/entry.scales[1] );
+		}
+
+		/// The cost of the model with parameter vector theta on a cache of one data set
+		double ComputeTotalCost( const VectorXd& theta, const BasisCache& cache ) const {
+			Eigen::Map<const MatrixXd> P( theta.data(), cache.dimension, cache.basisDim );
+			return ComputeTotalCost( P, cache, cache.entries[0] );
+		}
+
+		/// The cost of the family with parameter map A on a cache of a data system
+		double ComputeTotalCost( const AffineXd& A, const BasisCache& cache, const vector<VectorXd>& parameters ) const {
+			double T = 0.0;
+			VectorXd theta;
+			for(size_t j=0;j<cache.entries.size();++j) {
+				theta = A( parameters[j] );
+				Eigen::Map<const MatrixXd> P( theta.data(), cache.dimension, cache.basisDim );
+				T += ComputeTotalCost( P, cache, cache.entries[j] );
 			}
-			S1 /= data.count;
-				
-			double S2 = 0.0;
-			for(uint32_t i=0;i<data.count;++i) {
-				S2 += ( model.Partials(data.points[i]) - data.derivatives[i] ).squaredNorm();
+			return T / cache.entries.size();
+		}
+
+		/**
+		 * \brief As above, but stops once the cost exceeds bound, for a BasisCache or SparseBasisCache.
+		 *
+		 * If it stops early, complete is set to false and the result is a partial cost greater than bound.
+		 */
+		template<typename Cache>
+		double ComputeTotalCost( const AffineXd& A, const Cache& cache, const vector<VectorXd>& parameters, double bound, bool& complete ) const {
+			double T = 0.0;
+			double limit = bound * cache.entries.size();
+			VectorXd theta;
+			size_t j = 0;
+			for(;j<cache.entries.size() && T <= limit;++j) {
+				theta = A( parameters[j] );
+				Eigen::Map<const MatrixXd> P( theta.data(), cache.dimension, cache.basisDim );
+				T += ComputeTotalCost( P, cache, cache.entries[j] );
 			}
-			S2 /= data.count;
-			
-			return (fitWeight[0]/data.scales[0]) * S1 + (fitWeight[1]/data.scales[1]) * S2;
+			complete = ( j == cache.entries.size() );
+			return T / cache.entries.size();
 		}
 
 		template<typename Family>
@@ -37,6 +92,51 @@ namespace DRDSP {
 			}
 			return T / data.numParameters;
 		}
+
+		/// As above, but stops once the cost exceeds bound, setting complete to false if it stopped early
+		template<typename Family>
+		double ComputeTotalCost( const Family& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters, double bound, bool& complete ) const {
+			double T = 0.0;
+			double scale = 1.0 / data.numParameters;
+			complete = true;
+			for(uint32_t j=0;j<data.numParameters && complete;++j) {
+				complete = AddCost( family( parameters[j] ), data[j], scale, T, bound );
+			}
+			return T;
+		}
+
+	protected:
+
+		template<typename Model>
+		double ComputeModelCost( const Model& model, const ReducedData& data ) const {
+			typename std::decay<decltype( model(data.points[0]) )>::type f;
+			typename std::decay<decltype( model.Partials(data.points[0]) )>::type J;
+			double S1 = 0.0, S2 = 0.0;
+			for(uint32_t i=0;i<data.count;++i) {
+				EvaluateWithPartials( model, data.points[i], f, J );
+				S1 += ( f - data.vectors[i] ).squaredNorm();
+				S2 += ( J - data.derivatives[i] ).squaredNorm();
+			}
+			S1 /= data.count;
+			S2 /= data.count;
+			
+			return (fitWeight[0]/data.scales[0]) * S1 + (fitWeight[1]/data.scales[1]) * S2;
+		}
+
+		template<typename Model>
+		bool AddModelCost( const Model& model, const ReducedData& data, double scale, double& total, double bound ) const {
+			double w1 = scale * fitWeight[0] / ( data.scales[0] * data.count ),
+			       w2 = scale * fitWeight[1] / ( data.scales[1] * data.count );
+			typename std::decay<decltype( model(data.points[0]) )>::type f;
+			typename std::decay<decltype( model.Partials(data.points[0]) )>::type J;
+			for(uint32_t i=0;i<data.count;++i) {
+				EvaluateWithPartials( model, data.points[i], f, J );
+				total += w1 * ( f - data.vectors[i] ).squaredNorm();
+				total += w2 * ( J - data.derivatives[i] ).squaredNorm();
+				if( total > bound ) return false;
+			}
+			return true;
+		}
 	};
 }
 
@@ -3,6 +3,8 @@
 #include "../types.h"
 #include "../auto_diff.h"
 #include "polyharmonic_spline.h"
+#include "wendland.h"
+#include <type_traits>
 
 namespace DRDSP {
 	
@@ -91,30 +93,112 @@ namespace DRDSP {
 		}
 	};
 
+	/**
+	 * \brief The gradient g and Hessian H of x -> phi(|x|) at r.
+	 *
+	 * The second derivative of phi is found by differentiating phi' with dual numbers.
+	 * Both are zero at r = 0, matching Derivative.
+	 */
 	template<typename F>
+	void RadialGradientHessian( const F& func, const VectorXd& r, VectorXd& g, MatrixXd& H ) {
+		int64_t dim = r.size();
+		double rnorm = r.norm();
+		if( rnorm == 0.0 ) {
+			g.setZero( dim );
+			H.setZero( dim, dim );
+			return;
+		}
+		duald d = func.Derivative( duald( rnorm, 1.0 ) );
+		double a = d.x / rnorm;
+		double b = ( d.y - a ) / ( rnorm * rnorm );
+		g = a * r;
+		H.noalias() = b * r * r.transpose();
+		H.diagonal().array() += a;
+	}
+
+	/**
+	 * \brief phi(r) and phi'(r)/r, from one evaluation of the radial function with dual numbers.
+	 *
+	 * phi'(r)/r is zero at r = 0, matching Derivative.
+	 */
+	template<typename F>
+	void RadialValueGradient( const F& func, double r, double& phi, double& dphi ) {
+		if( r == 0.0 ) {
+			phi = func( 0.0 );
+			dphi = 0.0;
+			return;
+		}
+		duald v = func( duald( r, 1.0 ) );
+		phi = v.x;
+		dphi = v.y / r;
+	}
+
+	/**
+	 * \brief A radial basis function x -> weight phi(|x - centre|).
+	 *
+	 * With a fixed Dim the weight and centre are fixed-size vectors, so evaluating the function
+	 * and its derivative does not allocate. The fitting functions keep dynamic sizes.
+	 */
+	template<typename F,int Dim = Dynamic>
 	struct RBF {
 		typedef F RadialType;
-		VectorXd weight, centre;
+		typedef Matrix<double,Dim,1> VectorType;
+		typedef Matrix<double,Dim,Dim> MatrixType;
+		VectorType weight, centre;
 		F func;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW_IF_VECTORIZABLE_FIXED_SIZE(double,Dim)
 	
 		RBF() = default;
 		
 		explicit RBF( const F& f ) : func(f) {}
 
-		VectorXd operator()( const VectorXd& x ) const {
+		template<int D>
+		explicit RBF( const RBF<F,D>& rhs ) : weight(rhs.weight), centre(rhs.centre), func(rhs.func) {}
+
+		VectorType operator()( const VectorType& x ) const {
 			return weight * func( (x-centre).norm() );
 		}
 
-		MatrixXd Derivative( const VectorXd& x ) const {
-			VectorXd r = x - centre;
+		MatrixType Derivative( const VectorType& x ) const {
+			VectorType r = x - centre;
 			double rnorm = r.norm();
-			if( rnorm == 0.0 ) return VectorXd::Zero(x.size());
+			if( rnorm == 0.0 ) return MatrixType::Zero(weight.size(),x.size());
 			return weight * ( ( func.Derivative( rnorm ) / rnorm ) * r ).transpose();
 		}
 
+		/// operator() and Derivative together, sharing the distance and the radial function
+		void EvaluateWithPartials( const VectorType& x, VectorType& f, MatrixType& J ) const {
+			VectorType r = x - centre;
+			double phi, dphi;
+			RadialValueGradient( func, r.norm(), phi, dphi );
+			f.noalias() = weight * phi;
+			J.noalias() = weight * ( dphi * r ).transpose();
+		}
+
 		MatrixXd LinearWeight( const VectorXd& x ) const {
 			return MatrixXd::Identity(x.size(),x.size()) * func( (x-centre).norm() );
 		}
+
+		/// The scalar basis function, so that LinearWeight(x) = BasisValue(x) * I
+		double BasisValue( const VectorType& x ) const {
+			return func( (x-centre).norm() );
+		}
+
+		/// The gradient of BasisValue
+		VectorType BasisGradient( const VectorType& x ) const {
+			VectorType r = x - centre;
+			double rnorm = r.norm();
+			if( rnorm == 0.0 ) return VectorType::Zero(x.size());
+			return ( func.Derivative( rnorm ) / rnorm ) * r;
+		}
+
+		/// The derivatives of BasisValue and BasisGradient with respect to the centre
+		void BasisCentreDerivative( const VectorXd& x, VectorXd& dValue, MatrixXd& dGradient ) const {
+			RadialGradientHessian( func, x - centre, dValue, dGradient );
+			dValue = -dValue;
+			dGradient = -dGradient;
+		}
 		
 		MatrixXd LinearDerivativeWeight( const VectorXd& x ) const {
 			int64_t dim = x.size();
@@ -129,24 +213,31 @@ namespace DRDSP {
 		}
 	};
 
-	template<typename F>
+	template<typename F,int Dim = Dynamic>
 	struct EquiRBFZ2 {
 		typedef F RadialType;
-		VectorXd weight, centre;
+		typedef Matrix<double,Dim,1> VectorType;
+		typedef Matrix<double,Dim,Dim> MatrixType;
+		VectorType weight, centre;
 		F func;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW_IF_VECTORIZABLE_FIXED_SIZE(double,Dim)
 	
 		EquiRBFZ2() = default;
 		
 		explicit EquiRBFZ2( const F& f ) : func(f) {}
+
+		template<int D>
+		explicit EquiRBFZ2( const EquiRBFZ2<F,D>& rhs ) : weight(rhs.weight), centre(rhs.centre), func(rhs.func) {}
 		
-		VectorXd operator()( const VectorXd& x ) const {
+		VectorType operator()( const VectorType& x ) const {
 			return weight * ( func( (x-centre).norm() ) - func( (x+centre).norm() ) );
 		}
 
-		MatrixXd Derivative( const VectorXd& x ) const {
-			VectorXd sum;
+		MatrixType Derivative( const VectorType& x ) const {
+			VectorType sum;
 			sum.setZero( x.size() );
-			VectorXd r = x - centre;
+			VectorType r = x - centre;
 			double rnorm = r.norm();
 			if( rnorm != 0.0 ) {
 				sum += ( func.Derivative( rnorm ) / rnorm ) * r;
@@ -159,10 +250,48 @@ namespace DRDSP {
 			return weight * sum.transpose();
 		}
 
+		void EvaluateWithPartials( const VectorType& x, VectorType& f, MatrixType& J ) const {
+			VectorType rm = x - centre, rp = x + centre;
+			double pm, dm, pp, dp;
+			RadialValueGradient( func, rm.norm(), pm, dm );
+			RadialValueGradient( func, rp.norm(), pp, dp );
+			f.noalias() = weight * ( pm - pp );
+			J.noalias() = weight * ( dm * rm - dp * rp ).transpose();
+		}
+
 		MatrixXd LinearWeight( const VectorXd& x ) const {
 			return MatrixXd::Identity(x.size(),x.size()) * ( func( (x-centre).norm() ) - func( (x+centre).norm() ) );
 		}
 
+		double BasisValue( const VectorType& x ) const {
+			return func( (x-centre).norm() ) - func( (x+centre).norm() );
+		}
+
+		VectorType BasisGradient( const VectorType& x ) const {
+			VectorType sum;
+			sum.setZero( x.size() );
+			VectorType r = x - centre;
+			double rnorm = r.norm();
+			if( rnorm != 0.0 ) {
+				sum += ( func.Derivative( rnorm ) / rnorm ) * r;
+			}
+			r = x + centre;
+			rnorm = r.norm();
+			if( rnorm != 0.0 ) {
+				sum -= ( func.Derivative( rnorm ) / rnorm ) * r;
+			}
+			return sum;
+		}
+
+		void BasisCentreDerivative( const VectorXd& x, VectorXd& dValue, MatrixXd& dGradient ) const {
+			VectorXd g;
+			MatrixXd H;
+			RadialGradientHessian( func, x - centre, dValue, dGradient );
+			RadialGradientHessian( func, x + centre, g, H );
+			dValue = -( dValue + g );
+			dGradient = -( dGradient + H );
+		}
+
 		MatrixXd LinearDerivativeWeight( const VectorXd& x ) const {
 			int64_t dim = x.size();
 			MatrixXd C( dim * dim, dim );
@@ -187,143 +316,303 @@ namespace DRDSP {
 		}
 	};
 
+	/**
+	 * \brief True for radial basis types whose LinearWeight is a multiple of the identity.
+	 *
+	 * These provide BasisValue, BasisGradient and BasisCentreDerivative, allowing the least squares fit to be
+	 * solved through the much smaller Gram matrix of the scalar basis.
+	 */
+	template<typename F>
+	struct IsScalarBasis : std::false_type {};
+
+	template<typename F,int Dim>
+	struct IsScalarBasis<RBF<F,Dim>> : std::true_type {};
+
+	template<typename F,int Dim>
+	struct IsScalarBasis<EquiRBFZ2<F,Dim>> : std::true_type {};
+
+	/**
+	 * \brief The radial basis type F with a fixed state dimension Dim.
+	 *
+	 * Only RBF and EquiRBFZ2 have fixed-size versions, other types are left dynamic.
+	 */
+	template<typename F,int Dim>
+	struct WithDimension {
+		typedef F type;
+	};
+
+	template<typename F,int D,int Dim>
+	struct WithDimension<RBF<F,D>,Dim> {
+		typedef RBF<F,Dim> type;
+	};
+
+	template<typename F,int D,int Dim>
+	struct WithDimension<EquiRBFZ2<F,D>,Dim> {
+		typedef EquiRBFZ2<F,Dim> type;
+	};
+
+	/**
+	 * \brief The orbit of an equivariant kernel's centre and weight under its group elements g_k.
+	 *
+	 * Column k of centres and weights is g_k centre and g_k weight. With these cached, the kernel
+	 * finds the distances to the whole orbit at once instead of transforming the centre and weight
+	 * on every evaluation.
+	 */
+	struct KernelOrbit {
+		vector<MatrixXd> elements;  ///< The group elements g_k
+		MatrixXd centres,           ///< Column k is g_k centre
+		         weights;           ///< Column k is g_k weight
+
+		bool Empty() const {
+			return elements.empty();
+		}
+
+		/// An empty centre or weight, as in a family's prototype, leaves that part of the orbit empty
+		void Compute( const VectorXd& centre, const VectorXd& weight ) {
+			const int64_t K = (int64_t)elements.size();
+			centres.resize( centre.size(), centre.size() ? K : 0 );
+			weights.resize( weight.size(), weight.size() ? K : 0 );
+			for(int64_t k=0;k<centres.cols();++k) {
+				centres.col(k).noalias() = elements[k] * centre;
+			}
+			for(int64_t k=0;k<weights.cols();++k) {
+				weights.col(k).noalias() = elements[k] * weight;
+			}
+		}
+
+		/// The distances from x to the orbit centres, with diff = x - centres
+		void Distances( const VectorXd& x, MatrixXd& diff, VectorXd& r ) const {
+			diff = ( -centres ).colwise() + x;
+			r = diff.colwise().norm().transpose();
+		}
+
+		template<typename F>
+		VectorXd Evaluate( const F& func, const VectorXd& x ) const {
+			MatrixXd diff;
+			VectorXd r;
+			Distances( x, diff, r );
+			for(int64_t k=0;k<r.size();++k) {
+				r(k) = func( r(k) );
+			}
+			return weights * r;
+		}
+
+		template<typename F>
+		MatrixXd Derivative( const F& func, const VectorXd& x ) const {
+			MatrixXd diff;
+			VectorXd r;
+			Distances( x, diff, r );
+			for(int64_t k=0;k<r.size();++k) {
+				r(k) = ( r(k) == 0.0 ) ? 0.0 : func.Derivative( r(k) ) / r(k);
+			}
+			return weights * r.asDiagonal() * diff.transpose();
+		}
+
+		template<typename F>
+		void EvaluateWithPartials( const F& func, const VectorXd& x, VectorXd& f, MatrixXd& J ) const {
+			MatrixXd diff;
+			VectorXd r, phi( centres.cols() ), dphi( centres.cols() );
+			Distances( x, diff, r );
+			for(int64_t k=0;k<r.size();++k) {
+				RadialValueGradient( func, r(k), phi(k), dphi(k) );
+			}
+			f.noalias() = weights * phi;
+			J.noalias() = weights * dphi.asDiagonal() * diff.transpose();
+		}
+
+		/// sum_k g_k phi(|x - g_k centre|)
+		template<typename F>
+		MatrixXd LinearWeight( const F& func, const VectorXd& x ) const {
+			MatrixXd sum;
+			sum.setZero( x.size(), x.size() );
+			for(size_t k=0;k<elements.size();++k) {
+				sum.noalias() += elements[k] * func( ( x - centres.col(k) ).norm() );
+			}
+			return sum;
+		}
+
+		template<typename F>
+		MatrixXd LinearDerivativeWeight( const F& func, const VectorXd& x ) const {
+			int64_t dim = x.size();
+			MatrixXd C;
+			C.setZero( dim * dim, dim );
+			VectorXd r;
+			for(size_t k=0;k<elements.size();++k) {
+				r = x - centres.col(k);
+				double rnorm = r.norm();
+				if( rnorm == 0.0 ) continue;
+				double dphi = func.Derivative( rnorm ) / rnorm;
+				for(int64_t i=0;i<dim;++i) {
+					C.block(i*dim,0,dim,dim).noalias() += elements[k] * ( dphi * r[i] );
+				}
+			}
+			return C;
+		}
+	};
+
+	/**
+	 * \brief An RBF made equivariant under the cyclic group generated by generator, of order N.
+	 *
+	 * Sums weight phi(|x - centre|) over generator^k for k = 1, ..., N. Call ComputeOrbit after
+	 * changing the generator, and UpdateOrbit after changing only the centre or weight. Without a
+	 * cached orbit each evaluation computes it again.
+	 */
 	template<typename F,int N>
 	struct EquiRBFCyclic {
 		typedef F RadialType;
 		VectorXd weight, centre;
 		MatrixXd generator;
 		F func;
+		KernelOrbit orbit;
 
 		EquiRBFCyclic() = default;
 		
 		explicit EquiRBFCyclic( const F& f ) : func(f) {}
-		
-		VectorXd operator()( const VectorXd& x ) const {
-			VectorXd sum;
-			sum.setZero( x.size() );
-			VectorXd c = centre, w = weight;
+
+		/// Caches the powers of the generator and the orbit of the centre and weight
+		void ComputeOrbit() {
+			orbit.elements.resize( N );
+			MatrixXd g = generator;
 			for(int i=0;i<N;++i) {
-				w = generator * w;
-				c = generator * c;
-				sum.noalias() += w * func( (x-c).norm() );
+				orbit.elements[i] = g;
+				if( i + 1 < N ) g = generator * g;
 			}
-			return sum;
+			orbit.Compute( centre, weight );
+		}
+
+		/// Updates the orbit of the centre and weight, keeping the cached powers of the generator
+		void UpdateOrbit() {
+			if( orbit.Empty() ) ComputeOrbit();
+			else orbit.Compute( centre, weight );
+		}
+
+		VectorXd operator()( const VectorXd& x ) const {
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.Evaluate( func, x ); } );
 		}
 
 		MatrixXd Derivative( const VectorXd& x ) const {
-			VectorXd r;
-			MatrixXd sum;
-			sum.setZero( x.size() );
-			VectorXd c = centre, w = weight;
-			for(int i=0;i<N;++i) {
-				w = generator * w;
-				c = generator * c;
-				r = x - c;
-				double rnorm = r.norm();
-				if( rnorm == 0.0 ) continue;
-				sum += w * ( ( func.Derivative( rnorm ) / rnorm ) * r ).transpose();
-			}
-			return sum;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.Derivative( func, x ); } );
+		}
+
+		void EvaluateWithPartials( const VectorXd& x, VectorXd& f, MatrixXd& J ) const {
+			WithOrbit( [&]( const KernelOrbit& o ) { o.EvaluateWithPartials( func, x, f, J ); return 0; } );
 		}
 
 		MatrixXd LinearWeight( const VectorXd& x ) const {
-			MatrixXd sum( generator.rows(), generator.cols() );
-			MatrixXd g = MatrixXd::Identity( generator.rows(), generator.cols() );
-			sum.setIdentity() *= func( (x-c).norm() );
-			for(int i=1;i<N;++i) {
-				g = generator * g;
-				sum.noalias() += g * func( (x-g*c).norm() );
-			}
-			return sum;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.LinearWeight( func, x ); } );
 		}
 
 		MatrixXd LinearDerivativeWeight( const VectorXd& x ) const {
-			int64_t dim = x.size();
-			MatrixXd C( dim * dim, dim );
-			C.setZero();
-			VectorXd r = x - centre;
-			double rnorm = r.norm();
-			if( rnorm != 0.0 ) {
-				double dphi = func.Derivative( rnorm ) / rnorm;
-				for(int64_t i=0;i<dim;++i) {
-					C.block(i*dim,0,dim,dim).setIdentity() *= dphi * r[i];
-				}
-			}
-			MatrixXd g = MatrixXd::Identity( generator.rows(), generator.cols() );
-			for(int i=1;i<N;++i) {
-				g = generator * g;
-				r = x - g * centre;
-				rnorm = r.norm();
-				if( rnorm == 0.0 ) continue;
-				double dphi = func.Derivative( rnorm ) / rnorm;
-				for(int64_t i=0;i<dim;++i) {
-					C.block(i*dim,0,dim,dim) += g * ( dphi * r[i] );
-				}
-			}
-			return C;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.LinearDerivativeWeight( func, x ); } );
+		}
+
+	protected:
+		template<typename Body>
+		auto WithOrbit( Body&& body ) const -> decltype( body( orbit ) ) {
+			if( !orbit.Empty() ) return body( orbit );
+			EquiRBFCyclic copy( *this );
+			copy.ComputeOrbit();
+			return body( copy.orbit );
 		}
 	};
 
+	/**
+	 * \brief An RBF made equivariant under a finite group of matrices.
+	 *
+	 * Sums g weight phi(|x - g centre|) over the elements g of group. Call UpdateOrbit after
+	 * changing the centre, weight or group. Without a cached orbit each evaluation computes it again.
+	 */
 	template<typename F>
 	struct EquiRBFFinite {
 		typedef F RadialType;
 		VectorXd weight, centre;
 		vector<MatrixXd> group;
 		F func;
+		KernelOrbit orbit;
 
 		EquiRBFFinite() = default;
 		
 		explicit EquiRBFFinite( const F& f ) : func(f) {}
 
+		void ComputeOrbit() {
+			orbit.elements = group;
+			orbit.Compute( centre, weight );
+		}
+
+		void UpdateOrbit() {
+			ComputeOrbit();
+		}
+
 		VectorXd operator()( const VectorXd& x ) const {
-			VectorXd sum;
-			sum.setZero( x.size() );
-			for( const auto& g : group ) {
-				sum += g * weight * func( ( x - g * centre ).norm() );
-			}
-			return sum;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.Evaluate( func, x ); } );
 		}
 
 		MatrixXd Derivative( const VectorXd& x ) const {
-			VectorXd r;
-			MatrixXd sum;
-			sum.setZero( x.size() );
-			for( const auto& g : group ) {
-				r = x - g * centre;
-				double rnorm = r.norm();
-				if( rnorm == 0.0 ) continue;
-				sum.noalias() += g * weight * ( ( func.Derivative( rnorm ) / rnorm ) * r ).transpose();
-			}
-			return sum;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.Derivative( func, x ); } );
+		}
+
+		void EvaluateWithPartials( const VectorXd& x, VectorXd& f, MatrixXd& J ) const {
+			WithOrbit( [&]( const KernelOrbit& o ) { o.EvaluateWithPartials( func, x, f, J ); return 0; } );
 		}
 
 		MatrixXd LinearWeight( const VectorXd& x ) const {
-			MatrixXd sum;
-			sum.setZero( generator.rows(), generator.cols() );
-			for( const auto& g : group ) {
-				sum += g * func( ( x - g * centre ).norm() );
-			}
-			return sum;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.LinearWeight( func, x ); } );
 		}
 
 		MatrixXd LinearDerivativeWeight( const VectorXd& x ) const {
-			int64_t dim = x.size();
-			MatrixXd C;
-			C.setZero( dim * dim, dim );
-			VectorXd r;
-			for( const auto& g : group ) {
-				r = x - g * centre;
-				double rnorm = r.norm();
-				if( rnorm == 0.0 ) continue;
-				double dphi = func.Derivative( rnorm ) / rnorm;
-				for(int64_t i=0;i<dim;++i) {
-					C.block(i*dim,0,dim,dim) += g * ( dphi * r[i] );
-				}
-			}
-			return C;
+			return WithOrbit( [&]( const KernelOrbit& o ) { return o.LinearDerivativeWeight( func, x ); } );
+		}
+
+	protected:
+		template<typename Body>
+		auto WithOrbit( Body&& body ) const -> decltype( body( orbit ) ) {
+			if( !orbit.Empty() ) return body( orbit );
+			EquiRBFFinite copy( *this );
+			copy.ComputeOrbit();
+			return body( copy.orbit );
 		}
 	};
 
+	/// Updates the cached orbit of an equivariant kernel, nothing for other kernels
+	template<typename K>
+	void UpdateOrbit( K& ) {}
+
+	template<typename F,int N>
+	void UpdateOrbit( EquiRBFCyclic<F,N>& rbf ) {
+		rbf.UpdateOrbit();
+	}
+
+	template<typename F>
+	void UpdateOrbit( EquiRBFFinite<F>& rbf ) {
+		rbf.UpdateOrbit();
+	}
+
+	/// True for kernels that sum over the orbit of a group, EquiRBFCyclic and EquiRBFFinite
+	template<typename K>
+	struct HasOrbit : std::false_type {};
+
+	template<typename F,int N>
+	struct HasOrbit<EquiRBFCyclic<F,N>> : std::true_type {};
+
+	template<typename F>
+	struct HasOrbit<EquiRBFFinite<F>> : std::true_type {};
+
+	/// The powers of the generator, from the cached orbit if there is one
+	template<typename F,int N>
+	vector<MatrixXd> OrbitElements( const EquiRBFCyclic<F,N>& rbf ) {
+		if( !rbf.orbit.Empty() ) return rbf.orbit.elements;
+		EquiRBFCyclic<F,N> copy( rbf );
+		copy.centre.resize(0);
+		copy.weight.resize(0);
+		copy.ComputeOrbit();
+		return copy.orbit.elements;
+	}
+
+	template<typename F>
+	vector<MatrixXd> OrbitElements( const EquiRBFFinite<F>& rbf ) {
+		return rbf.group;
+	}
+
 	template<typename F>
 	struct EquiRBFSO2;
 
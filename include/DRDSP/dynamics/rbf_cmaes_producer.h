@@ -0,0 +1,199 @@
+#ifndef INCLUDED_DYNAMICS_RBF_CMAES_PRODUCER
+#define INCLUDED_DYNAMICS_RBF_CMAES_PRODUCER
+#include "rbf_family_producer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <Eigen/Eigenvalues>
+#include "../data/aabb.h"
+#include "../misc.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Produces a reduced family by searching for the centres with CMA-ES.
+	 *
+	 * The covariance matrix adaptation evolution strategy samples the flattened centre coordinates
+	 * from a Gaussian, and adapts its mean, step size and covariance towards the better candidates
+	 * of each generation. The coordinates are normalized to the unit cube of the scaled bounding box.
+	 * Candidates outside it are evaluated at the nearest point inside, with a penalty on the distance.
+	 *
+	 * The candidates of a generation are evaluated in parallel, each with the same fit as BruteForce.
+	 * When a run converges or stagnates the search restarts from a new random mean with twice the
+	 * population (IPOP-CMA-ES), until maxRestarts, maxEvaluations or timeBudget is reached.
+	 */
+	template<typename F = RBF<ThinPlateSpline>>
+	struct RBFCMAESProducer : RBFFamilyProducer<F> {
+		typedef typename RBFFamilyProducer<F>::ReducedFamily ReducedFamily;
+		double initialStep = 0.3,               ///< Initial step size, relative to the bounding box
+		       tolerance = 1e-4,                ///< Restart when the step size falls below this, relative to the bounding box
+		       timeBudget = 0.0;                ///< Wall-clock budget in seconds, or 0 for none
+		uint32_t populationSize = 0,            ///< Candidates in the first run, or 0 for 4 + 3 ln(n)
+		         maxEvaluations = 10000,
+		         maxRestarts = 4,
+		         stagnationGenerations = 50,    ///< Restart after this many generations without improvement
+		         seed = mt19937::default_seed;
+
+		RBFCMAESProducer() = default;
+
+		explicit RBFCMAESProducer( uint32_t nRBFs ) : RBFFamilyProducer<F>(nRBFs) {}
+
+		ReducedFamily Search( const ReducedDataSystem& data, const vector<VectorXd>& parameters, uint32_t numThreads = 1 ) const {
+			auto start = chrono::steady_clock::now();
+			const uint32_t dim = data.reducedData[0].dimension;
+			const int64_t n = dim * this->numRBFs;
+			const uint32_t threads = std::max( 1u, numThreads );
+
+			AABB box = data.ComputeBoundingBox();
+			box.Scale(this->boxScale);
+			VectorXd lower(n), width(n);
+			for(uint32_t k=0;k<this->numRBFs;++k) {
+				lower.segment(k*dim,dim) = box.bMin;
+				width.segment(k*dim,dim) = box.bMax - box.bMin;
+			}
+
+			vector<ParameterMapProducer<RBFFamily<F>>> pmp( threads, this->MakeParameterMapProducer() );
+			for( auto& p : pmp ) {
+				p.fitThreads = 1;
+			}
+			vector<typename RBFFamilyProducer<F>::Cache> caches( threads );
+			vector<RBFFamily<F>> reduced( threads, this->MakeFamily( dim ) );
+
+			mt19937 mt(seed);
+			normal_distribution<double> normal;
+			uniform_real_distribution<double> uniform;
+
+			ReducedFamily best;
+			double bestCost = -1.0;
+			uint32_t evaluations = 0;
+
+			auto outOfBudget = [&]() {
+				if( evaluations >= maxEvaluations ) return true;
+				if( timeBudget <= 0.0 ) return false;
+				return chrono::duration<double>( chrono::steady_clock::now() - start ).count() >= timeBudget;
+			};
+
+			uint32_t lambda = populationSize ? populationSize : 4 + (uint32_t)( 3.0 * log( (double)n ) );
+			for(uint32_t restart=0;restart<=maxRestarts && !outOfBudget();++restart,lambda*=2) {
+				const uint32_t mu = lambda / 2;
+				VectorXd weights(mu);
+				for(uint32_t i=0;i<mu;++i) {
+					weights[i] = log( mu + 0.5 ) - log( i + 1.0 );
+				}
+				weights /= weights.sum();
+				const double mueff = 1.0 / weights.squaredNorm();
+				const double cc = ( 4.0 + mueff / n ) / ( n + 4.0 + 2.0 * mueff / n );
+				const double cs = ( mueff + 2.0 ) / ( n + mueff + 5.0 );
+				const double c1 = 2.0 / ( ( n + 1.3 ) * ( n + 1.3 ) + mueff );
+				const double cmu = std::min( 1.0 - c1, 2.0 * ( mueff - 2.0 + 1.0 / mueff ) / ( ( n + 2.0 ) * ( n + 2.0 ) + mueff ) );
+				const double damps = 1.0 + 2.0 * std::max( 0.0, sqrt( ( mueff - 1.0 ) / ( n + 1.0 ) ) - 1.0 ) + cs;
+				const double chiN = sqrt( (double)n ) * ( 1.0 - 1.0 / ( 4.0 * n ) + 1.0 / ( 21.0 * n * n ) );
+
+				VectorXd mean(n);
+				for(int64_t i=0;i<n;++i) {
+					mean[i] = uniform(mt);
+				}
+				double sigma = initialStep;
+				VectorXd pc = VectorXd::Zero(n), ps = VectorXd::Zero(n), D = VectorXd::Ones(n);
+				MatrixXd C = MatrixXd::Identity(n,n), B = MatrixXd::Identity(n,n);
+				MatrixXd Z(n,lambda), Y(n,lambda), X(n,lambda), Ymu(n,mu);
+				VectorXd fitness(lambda), costs(lambda), yw;
+				vector<AffineXd> A(lambda);
+				vector<uint32_t> order(lambda);
+				double runBest = numeric_limits<double>::infinity();
+				uint32_t sinceImprovement = 0;
+
+				for(uint32_t gen=0;!outOfBudget();++gen) {
+					for(uint32_t j=0;j<lambda;++j) {
+						for(int64_t i=0;i<n;++i) {
+							Z(i,j) = normal(mt);
+						}
+					}
+					Y.noalias() = B * ( D.asDiagonal() * Z );
+					X = ( sigma * Y ).colwise() + mean;
+
+					ParallelRanges( lambda, threads, [&]( size_t begin, size_t end, uint32_t t ) {
+						for(size_t j=begin;j<end;++j) {
+							VectorXd u = X.col(j).cwiseMax(0.0).cwiseMin(1.0);
+							SetCentres( reduced[t], lower + width.cwiseProduct(u) );
+							bool complete;
+							costs[j] = this->Fit( reduced[t], data, parameters, pmp[t], caches[t], A[j], numeric_limits<double>::infinity(), complete, typename HasKroneckerStructure<RBFFamily<F>>::type() );
+							if( !std::isfinite( costs[j] ) ) costs[j] = numeric_limits<double>::infinity();
+							fitness[j] = costs[j] * ( 1.0 + ( X.col(j) - u ).squaredNorm() );
+						}
+					});
+					evaluations += lambda;
+
+					iota( order.begin(), order.end(), 0u );
+					sort( order.begin(), order.end(), [&]( uint32_t a, uint32_t b ) { return fitness[a] < fitness[b]; } );
+
+					for(uint32_t j=0;j<lambda;++j) {
+						if( costs[j] < bestCost || bestCost < 0.0 ) {
+							bestCost = costs[j];
+							RBFFamily<F> family = this->MakeFamily( dim );
+							SetCentres( family, lower + width.cwiseProduct( X.col(j).cwiseMax(0.0).cwiseMin(1.0) ) );
+							best = ReducedFamily( family, A[j] );
+							cout << restart << " \t" << evaluations << " \t" << bestCost << endl;
+						}
+					}
+
+					if( fitness[order[0]] < runBest * ( 1.0 - 1e-9 ) ) {
+						runBest = fitness[order[0]];
+						sinceImprovement = 0;
+					} else {
+						++sinceImprovement;
+					}
+
+					// move the mean towards the mu best candidates
+					for(uint32_t i=0;i<mu;++i) {
+						Ymu.col(i) = sqrt( weights[i] ) * Y.col( order[i] );
+					}
+					yw.noalias() = Ymu * weights.cwiseSqrt();
+					mean += sigma * yw;
+
+					// cumulate the evolution paths
+					ps = ( 1.0 - cs ) * ps + sqrt( cs * ( 2.0 - cs ) * mueff ) * ( B * ( D.cwiseInverse().asDiagonal() * ( B.transpose() * yw ) ) );
+					double psNorm = ps.norm();
+					bool hsig = psNorm / sqrt( 1.0 - std::pow( 1.0 - cs, 2.0 * ( gen + 1 ) ) ) / chiN < 1.4 + 2.0 / ( n + 1.0 );
+					pc = ( 1.0 - cc ) * pc;
+					if( hsig ) pc += sqrt( cc * ( 2.0 - cc ) * mueff ) * yw;
+
+					// rank-one and rank-mu updates of the covariance, then the step size
+					C *= 1.0 - c1 - cmu + ( hsig ? 0.0 : c1 * cc * ( 2.0 - cc ) );
+					C.noalias() += c1 * ( pc * pc.transpose() );
+					C.noalias() += cmu * ( Ymu * Ymu.transpose() );
+					C = 0.5 * ( C + C.transpose() ).eval();
+					sigma *= exp( ( cs / damps ) * ( psNorm / chiN - 1.0 ) );
+
+					SelfAdjointEigenSolver<MatrixXd> eigen( C );
+					B = eigen.eigenvectors();
+					D = eigen.eigenvalues().cwiseMax(0.0).cwiseSqrt();
+
+					if( sigma * D.maxCoeff() < tolerance ) break;
+					if( D.minCoeff() <= 1e-7 * D.maxCoeff() ) break;
+					if( sinceImprovement >= stagnationGenerations ) break;
+				}
+			}
+			return best;
+		}
+
+	protected:
+
+		static void SetCentres( RBFFamily<F>& family, const VectorXd& x ) {
+			int64_t dim = family.stateDim;
+			for(size_t k=0;k<family.centres.size();++k) {
+				family.centres[k] = x.segment( k * dim, dim );
+			}
+		}
+
+	};
+
+}
+
+#endif
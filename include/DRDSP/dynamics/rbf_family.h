@@ -28,9 +28,20 @@ namespace DRDSP {
 		}
 	};
 
+	/**
+	 * \brief Models with fixed centres whose linear part and RBF weights are the parameters.
+	 *
+	 * Each RBF is a copy of prototype with its centre and weight set, so the radial function and,
+	 * for the equivariant kernels, the generator or group are taken from the prototype.
+	 *
+	 * For kernels with HasOrbit, the orbits of the centres are computed by ComputeCentreOrbits and
+	 * passed to ComputeLinear and ComputeLinearDerivative. Linearization<RBFFamily> does this once
+	 * for a whole fit.
+	 */
 	template<typename F = RBF<ThinPlateSpline>>
 	struct RBFFamily : Family<RBFModel<F>> {
 		vector<VectorXd> centres;
+		F prototype;
 
 		RBFFamily() : RBFFamily(0,0) {}
 
@@ -44,10 +55,12 @@ namespace DRDSP {
 			RBFModel<F> model(stateDim,(uint32_t)centres.size());
 			for(uint32_t i=0;i<stateDim;++i)
 				model.linear.col(i) = parameter.segment(i*stateDim,stateDim);
-			for(size_t i=0;i<centres.size();++i)
+			for(size_t i=0;i<centres.size();++i) {
+				model.rbfs[i] = prototype;
 				model.rbfs[i].weight = parameter.segment((i+stateDim)*stateDim,stateDim);
-			for(size_t i=0;i<centres.size();++i)
 				model.rbfs[i].centre = centres[i];
+				UpdateOrbit( model.rbfs[i] );
+			}
 			return model;
 		}
 
@@ -84,16 +97,23 @@ namespace DRDSP {
 			}
 		}
 
+		/// The orbit of each centre under the prototype's group elements, empty unless HasOrbit<F>
+		vector<KernelOrbit> ComputeCentreOrbits() const {
+			return ComputeCentreOrbits( typename HasOrbit<F>::type() );
+		}
+
 		MatrixXd ComputeLinear( const VectorXd& x ) const {
-			Model model = (*this)( VectorXd::Zero(paramDim) );
+			return ComputeLinear( x, ComputeCentreOrbits() );
+		}
+
+		/// ComputeLinear with the orbits from ComputeCentreOrbits
+		MatrixXd ComputeLinear( const VectorXd& x, const vector<KernelOrbit>& orbits ) const {
 			MatrixXd L( stateDim, paramDim );
 			L.setZero();
 			for(uint32_t i=0;i<stateDim;++i) {
 				L.block(0,stateDim*i,stateDim,stateDim).setIdentity() *= x[i];
 			}
-			for(size_t i=0;i<centres.size();++i) {
-				L.block(0,stateDim*(stateDim+i),stateDim,stateDim) = model.rbfs[i].LinearWeight(x);
-			}
+			AddLinearWeights( x, orbits, L, typename HasOrbit<F>::type() );
 			return L;
 		}
 
@@ -104,15 +124,17 @@ namespace DRDSP {
 		}
 
 		MatrixXd ComputeLinearDerivative( const VectorXd& x ) const {
-			Model model = (*this)( VectorXd::Zero(paramDim) );
+			return ComputeLinearDerivative( x, ComputeCentreOrbits() );
+		}
+
+		/// ComputeLinearDerivative with the orbits from ComputeCentreOrbits
+		MatrixXd ComputeLinearDerivative( const VectorXd& x, const vector<KernelOrbit>& orbits ) const {
 			MatrixXd L( stateDim * stateDim, paramDim );
 			L.setZero();
 			for(uint32_t i=0;i<stateDim;++i) {
 				L.block(stateDim*i,stateDim*i,stateDim,stateDim).setIdentity();
 			}
-			for(size_t i=0;i<centres.size();++i) {
-				L.block(0,stateDim*(stateDim+i),stateDim*stateDim,stateDim) = model.rbfs[i].LinearDerivativeWeight(x);
-			}
+			AddLinearDerivativeWeights( x, orbits, L, typename HasOrbit<F>::type() );
 			return L;
 		}
 
@@ -121,7 +143,72 @@ namespace DRDSP {
 			T.setZero();
 			return T;
 		}
+
+	protected:
+		vector<KernelOrbit> ComputeCentreOrbits( std::false_type ) const {
+			return vector<KernelOrbit>();
+		}
+
+		vector<KernelOrbit> ComputeCentreOrbits( std::true_type ) const {
+			vector<MatrixXd> elements = OrbitElements( prototype );
+			vector<KernelOrbit> orbits( centres.size() );
+			for(size_t i=0;i<centres.size();++i) {
+				orbits[i].elements = elements;
+				orbits[i].Compute( centres[i], VectorXd() );
+			}
+			return orbits;
+		}
+
+		void AddLinearWeights( const VectorXd& x, const vector<KernelOrbit>&, MatrixXd& L, std::false_type ) const {
+			F rbf = prototype;
+			rbf.weight.setZero(stateDim);
+			for(size_t i=0;i<centres.size();++i) {
+				rbf.centre = centres[i];
+				L.block(0,stateDim*(stateDim+i),stateDim,stateDim) = rbf.LinearWeight(x);
+			}
+		}
+
+		void AddLinearWeights( const VectorXd& x, const vector<KernelOrbit>& orbits, MatrixXd& L, std::true_type ) const {
+			for(size_t i=0;i<centres.size();++i) {
+				L.block(0,stateDim*(stateDim+i),stateDim,stateDim) = orbits[i].LinearWeight( prototype.func, x );
+			}
+		}
+
+		void AddLinearDerivativeWeights( const VectorXd& x, const vector<KernelOrbit>&, MatrixXd& L, std::false_type ) const {
+			F rbf = prototype;
+			rbf.weight.setZero(stateDim);
+			for(size_t i=0;i<centres.size();++i) {
+				rbf.centre = centres[i];
+				L.block(0,stateDim*(stateDim+i),stateDim*stateDim,stateDim) = rbf.LinearDerivativeWeight(x);
+			}
+		}
+
+		void AddLinearDerivativeWeights( const VectorXd& x, const vector<KernelOrbit>& orbits, MatrixXd& L, std::true_type ) const {
+			for(size_t i=0;i<centres.size();++i) {
+				L.block(0,stateDim*(stateDim+i),stateDim*stateDim,stateDim) = orbits[i].LinearDerivativeWeight( prototype.func, x );
+			}
+		}
 	};
+
+	/// Computes the centre orbits once, for all the points of a fit
+	template<typename F>
+	struct Linearization<RBFFamily<F>> {
+		const RBFFamily<F>& family;
+		vector<KernelOrbit> orbits;  ///< From family.ComputeCentreOrbits()
+
+		explicit Linearization( const RBFFamily<F>& family ) : family(family), orbits( family.ComputeCentreOrbits() ) {}
+
+		MatrixXd ComputeLinear( const VectorXd& x ) const {
+			return family.ComputeLinear( x, orbits );
+		}
+
+		MatrixXd ComputeLinearDerivative( const VectorXd& x ) const {
+			return family.ComputeLinearDerivative( x, orbits );
+		}
+	};
+
+	template<typename F>
+	struct HasKroneckerStructure<RBFFamily<F>> : IsScalarBasis<F> {};
 }
 
 #endif
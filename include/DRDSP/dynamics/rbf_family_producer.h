@@ -2,47 +2,75 @@
 #define INCLUDED_DYNAMICS_RBF_FAMILY_PRODUCER
 #include "parameter_map_producer.h"
 #include "rbf_family.h"
+#include "centre_sampler.h"
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <random>
 #include "../data/histogram.h"
 #include "../data/aabb.h"
+#include "../philox.h"
 
 using namespace std;
 
 namespace DRDSP {
 
+	/**
+	 * \brief Produces a reduced family by trying many random sets of centres.
+	 *
+	 * With screenPoints > 0, each candidate is first fitted and costed on a stratified subsample of
+	 * that many points per data set. It is rejected if that cost exceeds screenFactor times the best
+	 * subsample cost so far. The full cost of the remaining candidates is abandoned as soon as it
+	 * exceeds the best cost so far. The histogram in output/costs.csv only includes the candidates
+	 * whose cost was evaluated in full.
+	 *
+	 * Families with HasSparseBasis, such as RBF<Wendland<K>> kernels, are fitted with a
+	 * SparseBasisCache and SolveSparse, so thousands of centres can be tried.
+	 */
 	template<typename F = RBF<ThinPlateSpline>>
 	struct RBFFamilyProducer : ProducerBase {
 		typedef PMapFamily<RBFFamily<F>,AffineXd> ReducedFamily;
-		double boxScale = 1.5;
-		uint32_t numRBFs = 30;
+		/// The basis cache kept between fits, sparse for families with HasSparseBasis
+		typedef typename conditional<HasSparseBasis<RBFFamily<F>>::value,SparseBasisCache,BasisCache>::type Cache;
+		CentreSampler sampler;
+		F prototype;                  ///< Copied to each candidate family, for the radial function and group
+		double boxScale = 1.5,
+		       screenFactor = 2.0;    ///< Candidates screening above this multiple of the best are rejected
+		uint32_t numRBFs = 30,
+		         screenPoints = 0,    ///< Points per data set used for screening, or 0 for none
+		         seed = mt19937::default_seed;
 
 		RBFFamilyProducer() = default;
 
 		explicit RBFFamilyProducer( uint32_t nRBFs ) : numRBFs(nRBFs) {}
 
 		ReducedFamily BruteForce( const ReducedDataSystem& data, const vector<VectorXd>& parameters, uint32_t numIterations ) const {
-			double Sft = 0.0, Sf = -1.0;
 			uint32_t dim = data.reducedData[0].dimension;
 			AABB box = data.ComputeBoundingBox();
 			box.Scale(boxScale);
-			RBFFamily<F> reduced( dim, numRBFs );
+			RBFFamily<F> reduced = MakeFamily( dim );
 			ReducedFamily best;
-			AffineXd A;
-			vector<double> costs(numIterations);
-			mt19937 mt;
-			ParameterMapProducer<RBFFamily<F>> pmp;
+			vector<double> costs;
+			costs.reserve(numIterations);
+			ParameterMapProducer<RBFFamily<F>> pmp = MakeParameterMapProducer();
+			CentreSampler centreSampler( sampler );
+			centreSampler.SetCloud( data );
+			ReducedDataSystem screenData = ScreenData( data );
+			TrialState state;
 
 			for(uint32_t i=0;i<numIterations;++i) {
-				SetPointsRandom( reduced.centres, box, mt );
-				A = pmp.SolveOrig( reduced, data, parameters );
-				Sft = ComputeTotalCost( ReducedFamily( reduced, A ), data, parameters );
-				costs[i] = Sft;
-				if( Sft < Sf || i==0 ) {
-					Sf = Sft;
-					best = ReducedFamily( reduced, A );
-					cout << i << " \t" << Sf << endl;
+				Philox4x32 rng( seed, i );
+				centreSampler.Sample( reduced.centres, box, rng );
+				double cost = Trial( reduced, data, screenData, parameters, pmp, state );
+				if( cost < 0.0 ) continue;
+				if( state.complete ) costs.push_back( cost );
+				if( cost < state.bestCost || state.bestCost < 0.0 ) {
+					state.bestCost = cost;
+					best = ReducedFamily( reduced, state.A );
+					cout << i << " \t" << cost << endl;
 				}
 			}
 
@@ -55,71 +83,241 @@ namespace DRDSP {
 		}
 
 		ReducedFamily BruteForce( const ReducedDataSystem& data, const vector<VectorXd>& parameters, uint32_t numIterations, uint32_t numThreads ) const {
-			vector<ReducedFamily> best(numThreads);
-			AABB box = data.ComputeBoundingBox();
-			box.Scale(boxScale);
-			uint32_t k = data.reducedData[0].dimension * numRBFs;
-			vector<future<void>> futures(numThreads);
-			uint32_t iterationsPerThread = numIterations / numThreads;
-			for(uint32_t i=0;i<numThreads;++i) {
-				futures[i] = async( launch::async,
-					[=,&data,&box,&parameters]( ReducedFamily& out ){
-						out = BruteForce( data,
-										  box,
-										  parameters,
-										  mt19937::default_seed + i * k,
-										  iterationsPerThread );
-					}, ref(best[i])
-				);
+			BruteForceSearch search( *this, data, parameters );
+			search.Start( numThreads, numIterations );
+			search.Wait();
+			auto best = search.Best();
+			return best ? best->family : ReducedFamily();
+		}
+
+		/**
+		 * \brief Searches for timeBudget seconds, or until the cost reaches targetCost.
+		 *
+		 * Returns a default ReducedFamily if no trial finished within the budget.
+		 */
+		ReducedFamily BruteForceTimed( const ReducedDataSystem& data, const vector<VectorXd>& parameters, double timeBudget, uint32_t numThreads, double targetCost = 0.0 ) const {
+			BruteForceSearch search( *this, data, parameters );
+			search.Start( numThreads, numeric_limits<uint32_t>::max(), timeBudget, targetCost );
+			search.Wait();
+			auto best = search.Best();
+			return best ? best->family : ReducedFamily();
+		}
+
+		struct BruteForceSearch;
+
+	protected:
+
+		RBFFamily<F> MakeFamily( uint32_t dim ) const {
+			RBFFamily<F> family( dim, numRBFs );
+			family.prototype = prototype;
+			return family;
+		}
+
+		ParameterMapProducer<RBFFamily<F>> MakeParameterMapProducer() const {
+			ParameterMapProducer<RBFFamily<F>> pmp;
+			pmp.fitWeight[0] = fitWeight[0];
+			pmp.fitWeight[1] = fitWeight[1];
+			pmp.fitThreads = fitThreads;
+			return pmp;
+		}
+
+		struct TrialState {
+			Cache cache, screenCache;
+			AffineXd A;
+			double bestCost = -1.0,
+			       bestScreenCost = -1.0;
+			bool complete = true;    ///< False if the last trial's cost was abandoned
+		};
+
+		ReducedDataSystem ScreenData( const ReducedDataSystem& data ) const {
+			return screenPoints ? data.Subsample( screenPoints ) : ReducedDataSystem();
+		}
+
+		/**
+		 * \brief Screens, fits and costs one set of centres, leaving the parameter map in state.A.
+		 *
+		 * Returns -1 if the candidate was screened out. Otherwise returns its cost, or a partial cost
+		 * above state.bestCost with state.complete set to false if the evaluation was abandoned.
+		 */
+		double Trial( const RBFFamily<F>& reduced, const ReducedDataSystem& data, const ReducedDataSystem& screenData, const vector<VectorXd>& parameters, ParameterMapProducer<RBFFamily<F>>& pmp, TrialState& state ) const {
+			typename HasKroneckerStructure<RBFFamily<F>>::type kronecker;
+			const double unbounded = numeric_limits<double>::infinity();
+			if( screenPoints ) {
+				double screenCost = Fit( reduced, screenData, parameters, pmp, state.screenCache, state.A, unbounded, state.complete, kronecker );
+				if( state.bestScreenCost >= 0.0 && screenCost > screenFactor * state.bestScreenCost ) return -1.0;
+				if( screenCost < state.bestScreenCost || state.bestScreenCost < 0.0 ) state.bestScreenCost = screenCost;
+			}
+			return Fit( reduced, data, parameters, pmp, state.cache, state.A, ( state.bestCost < 0.0 ) ? unbounded : state.bestCost, state.complete, kronecker );
+		}
+
+		/// Fits the parameter map for the current centres and returns its cost, abandoned once above bound
+		double Fit( const RBFFamily<F>& reduced, const ReducedDataSystem& data, const vector<VectorXd>& parameters, ParameterMapProducer<RBFFamily<F>>& pmp, BasisCache& cache, AffineXd& A, double bound, bool& complete, std::true_type ) const {
+			cache.Compute( reduced, data );
+			A = pmp.SolveKronecker( cache, parameters );
+			return ComputeTotalCost( A, cache, parameters, bound, complete );
+		}
+
+		double Fit( const RBFFamily<F>& reduced, const ReducedDataSystem& data, const vector<VectorXd>& parameters, ParameterMapProducer<RBFFamily<F>>& pmp, SparseBasisCache& cache, AffineXd& A, double bound, bool& complete, std::true_type ) const {
+			cache.Compute( reduced, data );
+			A = pmp.SolveSparse( cache, parameters );
+			return ComputeTotalCost( A, cache, parameters, bound, complete );
+		}
+
+		double Fit( const RBFFamily<F>& reduced, const ReducedDataSystem& data, const vector<VectorXd>& parameters, ParameterMapProducer<RBFFamily<F>>& pmp, Cache&, AffineXd& A, double bound, bool& complete, std::false_type ) const {
+			A = pmp.SolveOrig( reduced, data, parameters );
+			return ComputeTotalCost( ReducedFamily( reduced, A ), data, parameters, bound, complete );
+		}
+
+	};
+
+	/**
+	 * \brief An anytime brute force search running on its own threads.
+	 *
+	 * Threads take trial indices from a shared counter, so none idle while trials remain. The
+	 * candidate of trial i is drawn from the Philox4x32 stream ( seed, i ), and ties in cost go to
+	 * the lowest trial, so a run of maxIterations trials returns the same family on any number of
+	 * threads, and the same as the single threaded BruteForce. This does not hold with screening,
+	 * whose threshold depends on the trials each thread has seen.
+	 *
+	 * The best result is published through an atomic shared pointer and can be polled with Best
+	 * while the search runs. Each thread abandons a cost once it exceeds the global best.
+	 *
+	 * The search stops after maxIterations trials, after timeBudget seconds, once the cost reaches
+	 * targetCost, or when cancelled. The data and parameters must outlive the search.
+	 */
+	template<typename F>
+	struct RBFFamilyProducer<F>::BruteForceSearch {
+		struct Result {
+			ReducedFamily family;
+			double cost;
+			uint32_t iteration;
+		};
+
+		BruteForceSearch( const RBFFamilyProducer& producer, const ReducedDataSystem& data, const vector<VectorXd>& parameters ) :
+			producer(producer),
+			data(data),
+			parameters(parameters),
+			box( data.ComputeBoundingBox() ),
+			centreSampler( producer.sampler )
+		{
+			box.Scale( producer.boxScale );
+			centreSampler.SetCloud( data );
+			screenData = producer.ScreenData( data );
+		}
+
+		BruteForceSearch( const BruteForceSearch& ) = delete;
+		BruteForceSearch& operator=( const BruteForceSearch& ) = delete;
+
+		~BruteForceSearch() {
+			Cancel();
+			Wait();
+		}
+
+		/// Starts the search, timeBudget <= 0 for no time limit
+		void Start( uint32_t numThreads, uint32_t maxIterations = numeric_limits<uint32_t>::max(), double timeBudget = 0.0, double targetCost = 0.0 ) {
+			Wait();
+			this->maxIterations = maxIterations;
+			this->timeBudget = timeBudget;
+			this->targetCost = targetCost;
+			start = chrono::steady_clock::now();
+			stop = false;
+			next = 0;
+			completed = 0;
+			numThreads = std::max( 1u, numThreads );
+			workers.resize( numThreads );
+			for(uint32_t t=0;t<numThreads;++t) {
+				workers[t] = async( launch::async, [this](){ Work(); } );
 			}
+		}
 
-			vector<double> costs(numThreads);
+		void Cancel() {
+			stop = true;
+		}
 
-			for(uint32_t i=0;i<numThreads;++i) {
-				futures[i].wait();
-				costs[i] = ComputeTotalCost( best[i], data, parameters );
+		void Wait() {
+			for( auto& w : workers ) {
+				if( w.valid() ) w.get();
 			}
+			workers.clear();
+		}
 
-			double bestCost = costs[0];
-			uint32_t bestIndex = 0;
-			for(uint32_t i=1;i<numThreads;++i) {
-				if( costs[i] < bestCost ) {
-					bestCost = costs[i];
-					bestIndex = i;
-				}
+		bool Running() const {
+			for( const auto& w : workers ) {
+				if( w.valid() && w.wait_for( chrono::seconds(0) ) != future_status::ready ) return true;
 			}
+			return false;
+		}
+
+		/// The best result so far, or null if no trial has finished
+		shared_ptr<const Result> Best() const {
+			return atomic_load( &best );
+		}
 
-			return best[bestIndex];
+		/// The number of trials finished so far
+		uint32_t Iterations() const {
+			return completed;
 		}
 
 	protected:
+		RBFFamilyProducer producer;
+		const ReducedDataSystem& data;
+		const vector<VectorXd>& parameters;
+		AABB box;
+		CentreSampler centreSampler;
+		ReducedDataSystem screenData;
+		vector<future<void>> workers;
+		shared_ptr<const Result> best;
+		atomic<double> bestCost { -1.0 };
+		atomic<uint32_t> next { 0 }, completed { 0 };
+		atomic<bool> stop { false };
+		chrono::steady_clock::time_point start;
+		double timeBudget = 0.0, targetCost = 0.0;
+		uint32_t maxIterations = 0;
 
-		ReducedFamily BruteForce( const ReducedDataSystem& data, const AABB& box, const vector<VectorXd>& parameters, uint32_t seed, uint32_t numIterations ) const {
-			double cost = 0.0, bestCost = -1.0;
-			uint32_t dim = data.reducedData[0].dimension;
-			
-			RBFFamily<F> reduced( dim, numRBFs );
-			ReducedFamily best;
-			AffineXd A;
-			mt19937 mt(seed);
-			ParameterMapProducer<RBFFamily<F>> pmp;
+		bool OutOfTime() const {
+			return timeBudget > 0.0 && chrono::duration<double>( chrono::steady_clock::now() - start ).count() >= timeBudget;
+		}
 
-			for(uint32_t i=0;i<numIterations;++i) {
-				SetPointsRandom( reduced.centres, box, mt );
-				A = pmp.SolveOrig( reduced, data, parameters );
-				cost = ComputeTotalCost( ReducedFamily( reduced, A ), data, parameters );
-				if( cost < bestCost || i==0 ) {
-					bestCost = cost;
-					best = ReducedFamily( reduced, A );
-					cout << i << " \t" << bestCost << endl;
+		void Work() {
+			RBFFamily<F> reduced = producer.MakeFamily( data.reducedData[0].dimension );
+			ParameterMapProducer<RBFFamily<F>> pmp = producer.MakeParameterMapProducer();
+			TrialState state;
+			while( !stop ) {
+				if( OutOfTime() ) {
+					stop = true;
+					break;
 				}
+				uint32_t i = next++;
+				if( i >= maxIterations ) break;
+				Philox4x32 rng( producer.seed, i );
+				centreSampler.Sample( reduced.centres, box, rng );
+				state.bestCost = bestCost;
+				double cost = producer.Trial( reduced, data, screenData, parameters, pmp, state );
+				++completed;
+				if( cost < 0.0 ) continue;
+				Offer( reduced, state.A, cost, i );
+				if( cost <= targetCost ) stop = true;
 			}
-			return best;
 		}
 
+		/// Publishes the result if it beats the global best, ties going to the lower iteration
+		bool Offer( const RBFFamily<F>& reduced, const AffineXd& A, double cost, uint32_t iteration ) {
+			double current = bestCost;
+			do {
+				if( current >= 0.0 && cost > current ) return false;
+				if( cost == current ) break;
+			} while( !bestCost.compare_exchange_weak( current, cost ) );
+
+			shared_ptr<const Result> result = make_shared<const Result>( Result{ ReducedFamily( reduced, A ), cost, iteration } );
+			shared_ptr<const Result> old = atomic_load( &best );
+			do {
+				if( old && ( old->cost < cost || ( old->cost == cost && old->iteration < iteration ) ) ) return false;
+			} while( !atomic_compare_exchange_weak( &best, &old, result ) );
+			cout << iteration << " \t" << cost << endl;
+			return true;
+		}
 	};
 
 }
 
 #endif
-
@@ -0,0 +1,226 @@
+#ifndef INCLUDED_DYNAMICS_RBF_GREEDY_PRODUCER
+#define INCLUDED_DYNAMICS_RBF_GREEDY_PRODUCER
+#include "parameter_map_producer.h"
+#include "rbf_family.h"
+#include "basis_cache.h"
+#include <iostream>
+#include <random>
+#include <Eigen/Cholesky>
+#include "../data/aabb.h"
+#include "../misc.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Produces a reduced family by selecting centres one at a time (orthogonal least squares).
+	 *
+	 * The candidates are reduced data points, some of them jittered. Each step adds the candidate
+	 * that most reduces the cost of the parameter map fit. With c = [p;1], a basis function contributes
+	 * a block of pdim+1 columns to the Kronecker system of ParameterMapProducer::SolveKronecker, and a
+	 * block Cholesky factor of the selected columns is extended one block per step. Each candidate
+	 * keeps its projection onto the selected blocks, so scoring it costs O((pdim+1)^3) and updating
+	 * it costs O(N + numRBFs) per step.
+	 *
+	 * Requires a scalar basis, see IsScalarBasis. The basis of every candidate is stored at every
+	 * point, so memory is O(numCandidates * N * d).
+	 */
+	template<typename F = RBF<ThinPlateSpline>>
+	struct RBFGreedyProducer : ProducerBase {
+		typedef PMapFamily<RBFFamily<F>,AffineXd> ReducedFamily;
+		uint32_t numRBFs = 30,
+		         numCandidates = 500,
+		         seed = mt19937::default_seed;
+		double jitter = 0.05,             ///< Standard deviation of the jitter, relative to the bounding box
+		       jitteredFraction = 0.5;    ///< Fraction of the candidates that are jittered
+
+		RBFGreedyProducer() = default;
+
+		explicit RBFGreedyProducer( uint32_t nRBFs ) : numRBFs(nRBFs) {}
+
+		ReducedFamily Select( const ReducedDataSystem& data, const vector<VectorXd>& parameters, uint32_t numThreads = 1 ) const {
+			static_assert( IsScalarBasis<F>::value, "RBFGreedyProducer requires a scalar radial basis" );
+
+			uint32_t dim = data.reducedData[0].dimension;
+			mt19937 mt(seed);
+
+			RBFFamily<F> pool( dim, numCandidates );
+			pool.centres = GenerateCandidates( data, mt );
+
+			BasisCache cache;
+			cache.Compute( pool, data );
+
+			vector<uint32_t> selected = SelectBasis( cache, parameters, dim + numRBFs, numThreads );
+
+			RBFFamily<F> reduced( dim, (uint32_t)selected.size() - dim );
+			for(size_t i=dim;i<selected.size();++i) {
+				reduced.centres[i-dim] = pool.centres[ selected[i] - dim ];
+			}
+
+			ParameterMapProducer<RBFFamily<F>> pmp;
+			pmp.fitWeight[0] = fitWeight[0];
+			pmp.fitWeight[1] = fitWeight[1];
+			pmp.fitThreads = numThreads;
+			ReducedFamily result( reduced, pmp.SolveKronecker( reduced, data, parameters ) );
+			cout << reduced.centres.size() << " \t" << ComputeTotalCost( result, data, parameters ) << endl;
+			return result;
+		}
+
+		/// Reduced data points, a jitteredFraction of them perturbed by Gaussian noise
+		vector<VectorXd> GenerateCandidates( const ReducedDataSystem& data, mt19937& mt ) const {
+			AABB box = data.ComputeBoundingBox();
+			VectorXd sigma = jitter * ( box.bMax - box.bMin );
+			size_t total = data.TotalPoints();
+			uniform_int_distribution<size_t> pick( 0, total - 1 );
+			uniform_real_distribution<double> uniform;
+			normal_distribution<double> normal;
+
+			vector<VectorXd> candidates( numCandidates );
+			for( auto& c : candidates ) {
+				size_t k = pick(mt);
+				uint32_t j = 0;
+				while( k >= data[j].count ) {
+					k -= data[j].count;
+					++j;
+				}
+				c = data[j].points[k];
+				if( uniform(mt) < jitteredFraction ) {
+					for(int64_t i=0;i<c.size();++i) {
+						c[i] += sigma[i] * normal(mt);
+					}
+				}
+			}
+			return candidates;
+		}
+
+	protected:
+
+		/**
+		 * \brief Greedily selects basis functions from the cache, returning their indices in order.
+		 *
+		 * The first dim basis functions (the linear part) are always selected.
+		 */
+		vector<uint32_t> SelectBasis( const BasisCache& cache, const vector<VectorXd>& parameters, uint32_t maxSelected, uint32_t numThreads ) const {
+			const int64_t dim = cache.dimension;
+			const int64_t M = cache.basisDim;
+			const int64_t q = parameters[0].size() + 1;
+			const size_t P = cache.entries.size();
+			maxSelected = (uint32_t)std::min<int64_t>( maxSelected, M );
+
+			vector<VectorXd> c(P);
+			vector<double> w1(P), w2(P);
+			for(size_t p=0;p<P;++p) {
+				c[p].resize(q);
+				c[p] << parameters[p], 1.0;
+				w1[p] = fitWeight[0] / cache.entries[p].scales[0];
+				w2[p] = fitWeight[1] / cache.entries[p].scales[1];
+			}
+
+			// per candidate: W = L^{-1} C (projection onto the selected blocks), Schur complement S and residual r
+			vector<MatrixXd> W( M ), S( M ), r( M );
+			{
+				vector<VectorXd> diag(P);
+				MatrixXd R( dim, M );
+				for(size_t p=0;p<P;++p) {
+					const BasisCache::Entry& e = cache.entries[p];
+					diag[p] = w1[p] * e.B.rowwise().squaredNorm() + w2[p] * e.Db.rowwise().squaredNorm();
+				}
+				for(int64_t k=0;k<M;++k) {
+					W[k].resize( maxSelected * q, q );
+					S[k].setZero( q, q );
+					r[k].setZero( dim, q );
+				}
+				for(size_t p=0;p<P;++p) {
+					const BasisCache::Entry& e = cache.entries[p];
+					R.noalias() = w1[p] * ( e.V * e.B.transpose() );
+					R.noalias() += w2[p] * ( e.Y * e.Db.transpose() );
+					MatrixXd ccT = c[p] * c[p].transpose();
+					for(int64_t k=0;k<M;++k) {
+						S[k] += diag[p](k) * ccT;
+						r[k].noalias() += R.col(k) * c[p].transpose();
+					}
+				}
+			}
+
+			vector<uint32_t> selected;
+			vector<bool> isSelected( M, false );
+			vector<double> gain( M );
+			vector<VectorXd> g(P);
+			MatrixXd L, z;
+
+			while( selected.size() < maxSelected ) {
+				int64_t s = -1;
+				if( (int64_t)selected.size() < dim ) {
+					s = (int64_t)selected.size();
+				} else {
+					ParallelRanges( M, numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+						for(size_t k=begin;k<end;++k) {
+							gain[k] = isSelected[k] ? -1.0 : ComputeGain( S[k], r[k] );
+						}
+					});
+					double best = 0.0;
+					for(int64_t k=dim;k<M;++k) {
+						if( gain[k] > best ) {
+							best = gain[k];
+							s = k;
+						}
+					}
+					if( s < 0 ) break;
+				}
+
+				LLT<MatrixXd> llt( Regularized( S[s] ) );
+				if( llt.info() != Success ) break;
+				L = llt.matrixL();
+				z = llt.matrixU().solve<OnTheRight>( r[s] );
+
+				for(size_t p=0;p<P;++p) {
+					const BasisCache::Entry& e = cache.entries[p];
+					g[p].noalias() = w1[p] * ( e.B * e.B.row(s).transpose() );
+					g[p].noalias() += w2[p] * ( e.Db * e.Db.row(s).transpose() );
+				}
+
+				int64_t t = (int64_t)selected.size() * q;
+				ParallelRanges( M, numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+					MatrixXd C( q, q ), w( q, q );
+					for(size_t k=begin;k<end;++k) {
+						if( isSelected[k] || (int64_t)k == s ) continue;
+						C.setZero();
+						for(size_t p=0;p<P;++p) {
+							C.noalias() += g[p](k) * ( c[p] * c[p].transpose() );
+						}
+						if( t > 0 ) {
+							C.noalias() -= W[s].topRows(t).transpose() * W[k].topRows(t);
+						}
+						w = L.triangularView<Lower>().solve( C );
+						W[k].middleRows( t, q ) = w;
+						S[k].noalias() -= w.transpose() * w;
+						r[k].noalias() -= z * w;
+					}
+				});
+
+				isSelected[s] = true;
+				selected.push_back( (uint32_t)s );
+			}
+			return selected;
+		}
+
+		static MatrixXd Regularized( const MatrixXd& S ) {
+			MatrixXd A = S;
+			A.diagonal().array() += 1e-12 * std::max( S.trace(), 1e-300 );
+			return A;
+		}
+
+		/// The cost reduction from adding a block, tr( r S^{-1} r^T )
+		static double ComputeGain( const MatrixXd& S, const MatrixXd& r ) {
+			LLT<MatrixXd> llt( Regularized(S) );
+			if( llt.info() != Success ) return -1.0;
+			if( llt.matrixLLT().diagonal().minCoeff() <= 1e-8 * std::sqrt( S.diagonal().maxCoeff() ) ) return -1.0;
+			return llt.matrixU().solve<OnTheRight>( r ).squaredNorm();
+		}
+
+	};
+
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef INCLUDED_DYNAMICS_RBF_LM_PRODUCER
+#define INCLUDED_DYNAMICS_RBF_LM_PRODUCER
+#include "rbf_family_producer.h"
+#include "basis_cache.h"
+#include "../least_squares.h"
+#include <iostream>
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
+#include "../data/aabb.h"
+#include "../misc.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Moves the centres of a reduced family to reduce the cost of its fit (variable projection).
+	 *
+	 * For fixed centres the coefficients are the least squares solution of
+	 * ParameterMapProducer::SolveKronecker, so the cost is a function of the centres alone.
+	 * This is minimized by Levenberg-Marquardt, using the analytic derivatives of the basis with
+	 * respect to the centres (BasisCentreDerivative) and Kaufman's approximation of the Jacobian.
+	 * Centres are kept inside the scaled bounding box of the data.
+	 *
+	 * The minimized cost is the one solved by SolveKronecker, which equals data.numParameters times
+	 * ComputeTotalCost when the data sets have the same number of points.
+	 *
+	 * Requires a scalar basis, see IsScalarBasis.
+	 */
+	template<typename F = RBF<ThinPlateSpline>>
+	struct RBFLMProducer : ProducerBase {
+		typedef PMapFamily<RBFFamily<F>,AffineXd> ReducedFamily;
+		double boxScale = 1.5,
+		       initialDamping = 1e-3,
+		       maxDamping = 1e10,
+		       tolerance = 1e-6;         ///< Stop when an iteration reduces the cost by less than this fraction
+		uint32_t numRBFs = 30,
+		         maxIterations = 50;
+
+		RBFLMProducer() = default;
+
+		explicit RBFLMProducer( uint32_t nRBFs ) : numRBFs(nRBFs) {}
+
+		/// Refines the best of numIterations brute force iterations
+		ReducedFamily Optimize( const ReducedDataSystem& data, const vector<VectorXd>& parameters, uint32_t numIterations, uint32_t numThreads ) const {
+			RBFFamilyProducer<F> producer( numRBFs );
+			producer.fitWeight[0] = fitWeight[0];
+			producer.fitWeight[1] = fitWeight[1];
+			producer.boxScale = boxScale;
+			ReducedFamily seed = ( numThreads > 1 ) ? producer.BruteForce( data, parameters, numIterations, numThreads )
+			                                        : producer.BruteForce( data, parameters, numIterations );
+			return Refine( seed.family, data, parameters, numThreads );
+		}
+
+		ReducedFamily Refine( const RBFFamily<F>& initial, const ReducedDataSystem& data, const vector<VectorXd>& parameters, uint32_t numThreads = 1 ) const {
+			static_assert( IsScalarBasis<F>::value, "RBFLMProducer requires a scalar radial basis" );
+
+			AABB box = data.ComputeBoundingBox();
+			box.Scale(boxScale);
+			ParameterMapProducer<RBFFamily<F>> pmp;
+			pmp.fitWeight[0] = fitWeight[0];
+			pmp.fitWeight[1] = fitWeight[1];
+			pmp.fitThreads = numThreads;
+
+			RBFFamily<F> family = initial, trial = initial;
+			BasisCache cache, trialCache;
+			AffineXd A, trialA;
+			double cost = Fit( family, data, parameters, pmp, cache, A );
+			double lambda = initialDamping;
+			cout << "0 \t" << ComputeTotalCost( A, cache, parameters ) << endl;
+
+			MatrixXd H, Hd;
+			VectorXd g, delta;
+			for(uint32_t iter=1;iter<=maxIterations;++iter) {
+				ComputeNormalEquations( family, cache, A, parameters, pmp, numThreads, H, g );
+
+				double trialCost = cost;
+				while( lambda < maxDamping ) {
+					Hd = H;
+					Hd.diagonal() += lambda * ( H.diagonal().cwiseAbs().array() + 1e-12 * H.diagonal().cwiseAbs().maxCoeff() ).matrix();
+					LDLT<MatrixXd> ldlt( Hd );
+					if( ldlt.info() == Success && ldlt.isPositive() ) {
+						delta = ldlt.solve( -g );
+						MoveCentres( family, delta, box, trial );
+						trialCost = Fit( trial, data, parameters, pmp, trialCache, trialA );
+						if( trialCost < cost ) break;
+					}
+					lambda *= 10.0;
+				}
+				if( !( trialCost < cost ) ) break;
+
+				double decrease = cost - trialCost;
+				std::swap( family, trial );
+				std::swap( cache, trialCache );
+				std::swap( A, trialA );
+				cost = trialCost;
+				lambda = std::max( lambda * 0.1, 1e-12 );
+				cout << iter << " \t" << ComputeTotalCost( A, cache, parameters ) << endl;
+
+				if( decrease < tolerance * cost ) break;
+			}
+			return ReducedFamily( family, A );
+		}
+
+	protected:
+
+		/// Solves for the coefficients and returns the cost minimized by SolveKronecker
+		double Fit( const RBFFamily<F>& family, const ReducedDataSystem& data, const vector<VectorXd>& parameters, ParameterMapProducer<RBFFamily<F>>& pmp, BasisCache& cache, AffineXd& A ) const {
+			cache.Compute( family, data );
+			A = pmp.SolveKronecker( cache, parameters );
+			double T = 0.0;
+			VectorXd theta;
+			for(size_t j=0;j<cache.entries.size();++j) {
+				theta = A( parameters[j] );
+				Eigen::Map<const MatrixXd> P( theta.data(), cache.dimension, cache.basisDim );
+				T += ComputeTotalCost( P, cache, cache.entries[j] ) * cache.entries[j].count;
+			}
+			return T;
+		}
+
+		static void MoveCentres( const RBFFamily<F>& family, const VectorXd& delta, const AABB& box, RBFFamily<F>& result ) {
+			result = family;
+			int64_t dim = family.stateDim;
+			for(size_t k=0;k<result.centres.size();++k) {
+				result.centres[k] += delta.segment( k * dim, dim );
+				result.centres[k] = result.centres[k].cwiseMax( box.bMin ).cwiseMin( box.bMax );
+			}
+		}
+
+		/**
+		 * \brief The Gauss-Newton system H delta = -g for the centres.
+		 *
+		 * With residuals r and the Jacobian J of r with respect to the centres at fixed coefficients,
+		 * g = J^T r is the exact gradient (half) of the cost, because r is orthogonal to the columns of
+		 * the linear problem Phi. Kaufman's Jacobian projects J onto the complement of Phi, giving
+		 * H = J^T J - (Phi^T J)^T (Phi^T Phi)^+ (Phi^T J).
+		 *
+		 * Phi^T Phi is the Kronecker matrix Gbig (x) I_d of SolveKronecker. The column of Phi^T J for
+		 * centre k, coordinate j is vec( P_{d+k} (c (x) s)^T ) summed over the data sets, where
+		 * s = sum_i w1 db_j b + w2 Db dDb_j^T, so it is found from an m-vector per data set and column.
+		 */
+		void ComputeNormalEquations( const RBFFamily<F>& family, const BasisCache& cache, const AffineXd& A, const vector<VectorXd>& parameters, const ParameterMapProducer<RBFFamily<F>>& pmp, uint32_t numThreads, MatrixXd& H, VectorXd& g ) const {
+			const int64_t d = cache.dimension;
+			const int64_t m = cache.basisDim;
+			const int64_t K = m - d;
+			const int64_t nc = K * d;
+			const int64_t q = parameters[0].size() + 1;
+			const int64_t n = m * q;
+			const uint32_t threads = std::max( 1u, numThreads );
+
+			auto model = family( VectorXd::Zero(family.paramDim) );
+			NormalEquations total( nc );
+			MatrixXd C = MatrixXd::Zero( d * n, nc );
+			VectorXd c( q ), theta;
+
+			for(size_t p=0;p<cache.entries.size();++p) {
+				const BasisCache::Entry& e = cache.entries[p];
+				const double w1 = fitWeight[0] / e.scales[0],
+				             w2 = fitWeight[1] / e.scales[1],
+				             r1 = sqrt(w1),
+				             r2 = sqrt(w2);
+				theta = A( parameters[p] );
+				Eigen::Map<const MatrixXd> P( theta.data(), d, m );
+
+				vector<NormalEquations> partial( threads );
+				vector<MatrixXd> S( threads );
+				ParallelRanges( e.count, threads, [&]( size_t begin, size_t end, uint32_t thread ) {
+					NormalEquations& eq = partial[thread];
+					eq.Reset( nc );
+					S[thread].setZero( m, nc );
+					MatrixXd J( d + d * d, nc ), dDb, R2;
+					VectorXd r( d + d * d ), db;
+					for(size_t i=begin;i<end;++i) {
+						const VectorXd& x = e.source->points[i];
+						auto b = e.B.col(i);
+						auto Db = e.Db.middleCols( i * d, d );
+						r.head(d).noalias() = r1 * ( P * b - e.V.col(i) );
+						R2.noalias() = P * Db;
+						R2 -= e.Y.middleCols( i * d, d );
+						r.tail( d * d ) = r2 * Eigen::Map<const VectorXd>( R2.data(), d * d );
+						for(int64_t k=0;k<K;++k) {
+							model.rbfs[k].BasisCentreDerivative( x, db, dDb );
+							auto Pk = P.col( d + k );
+							for(int64_t j=0;j<d;++j) {
+								int64_t col = k * d + j;
+								J.col(col).head(d) = ( r1 * db(j) ) * Pk;
+								for(int64_t l=0;l<d;++l) {
+									J.col(col).segment( d + l * d, d ) = ( r2 * dDb(j,l) ) * Pk;
+								}
+								S[thread].col(col) += ( w1 * db(j) ) * b;
+								S[thread].col(col).noalias() += w2 * ( Db * dDb.row(j).transpose() );
+							}
+						}
+						eq.Add( J, r );
+					}
+				});
+
+				c << parameters[p], 1.0;
+				for(uint32_t t=0;t<threads;++t) {
+					if( !partial[t].AtA.size() ) continue;
+					total += partial[t];
+					for(int64_t col=0;col<nc;++col) {
+						auto Pk = P.col( d + col / d );
+						for(int64_t a=0;a<q;++a) {
+							for(int64_t i=0;i<m;++i) {
+								C.col(col).segment( ( a * m + i ) * d, d ) += ( c(a) * S[t](i,col) ) * Pk;
+							}
+						}
+					}
+				}
+			}
+
+			H = total.Matrix();
+			g = total.Aty;
+
+			// (Phi^T J)^T (Gbig (x) I_d)^+ (Phi^T J), with Gbig = U L U^T
+			MatrixXd Gbig, Rbig;
+			pmp.ComputeKroneckerSystem( cache, parameters, Gbig, Rbig );
+			SelfAdjointEigenSolver<MatrixXd> eigen( Gbig );
+			const VectorXd& L = eigen.eigenvalues();
+			double threshold = 1e-12 * std::max( L.cwiseAbs().maxCoeff(), 1e-300 );
+			VectorXd invSqrt = VectorXd::Zero( n );
+			for(int64_t i=0;i<n;++i) {
+				if( L(i) > threshold ) invSqrt(i) = 1.0 / sqrt( L(i) );
+			}
+			MatrixXd T = eigen.eigenvectors() * invSqrt.asDiagonal();
+			MatrixXd Z( d * n, nc );
+			for(int64_t col=0;col<nc;++col) {
+				Eigen::Map<const MatrixXd> M( C.col(col).data(), d, n );
+				Eigen::Map<MatrixXd>( Z.col(col).data(), d, n ).noalias() = M * T;
+			}
+			H.noalias() -= Z.transpose() * Z;
+		}
+
+	};
+
+}
+
+#endif
@@ -1,5 +1,7 @@
 #ifndef INCLUDED_DYNAMICS_RBF_MODEL
 #define INCLUDED_DYNAMICS_RBF_MODEL
+#include <fstream>
+#include <vector>
 #include "../types.h"
 #include "model.h"
 #include "radial_basis.h"
@@ -8,15 +10,29 @@ using namespace std;
 
 namespace DRDSP {
 
-	template<typename F = RBF<ThinPlateSpline>>
-	struct RBFModel : Model<> {
-		MatrixXd linear;
-		vector<F> rbfs;
+	/**
+	 * \brief The model x -> linear x + sum_k rbfs[k](x).
+	 *
+	 * With a fixed Dim the state, linear part and RBFs are fixed-size, for RBF and EquiRBFZ2 (see
+	 * WithDimension), so evaluating the model does not allocate. A dynamic model converts to a fixed
+	 * one of the same dimension, which DispatchDimension does from the runtime dimension.
+	 */
+	template<typename F = RBF<ThinPlateSpline>,int Dim = Dynamic>
+	struct RBFModel : Model<Matrix<double,Dim,1>> {
+		typedef typename WithDimension<F,Dim>::type RBFType;
+		typedef Matrix<double,Dim,1> VectorType;
+		typedef Matrix<double,Dim,Dim> MatrixType;
+		using Model<VectorType>::stateDim;
+
+		MatrixType linear;
+		vector<RBFType,aligned_allocator<RBFType>> rbfs;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW_IF_VECTORIZABLE_FIXED_SIZE(double,Dim)
 
 		RBFModel() = default;
 		
 		RBFModel( uint32_t dim, uint32_t nRBFs ) :
-			Model<>(dim),
+			Model<VectorType>(dim),
 			rbfs(nRBFs)
 		{
 			linear.setZero(stateDim,stateDim);
@@ -26,41 +42,82 @@ namespace DRDSP {
 			}
 		}
 
-		VectorXd operator()( const VectorXd& x ) const {
-			VectorXd sum = linear * x;
+		template<int D>
+		explicit RBFModel( const RBFModel<F,D>& rhs ) :
+			Model<VectorType>(rhs.stateDim),
+			linear(rhs.linear),
+			rbfs(rhs.rbfs.begin(),rhs.rbfs.end())
+		{}
+
+		VectorType operator()( const VectorType& x ) const {
+			VectorType sum = linear * x;
 			for( const auto& r : rbfs )
 				sum += r(x);
 			return sum;
 		}
 
-		MatrixXd Partials( const VectorXd& x ) const {
-			MatrixXd sum = linear;
+		MatrixType Partials( const VectorType& x ) const {
+			MatrixType sum = linear;
 			for( const auto& r : rbfs )
 				sum += r.Derivative(x);
 			return sum;
 		}
 
+		/// The value and the Jacobian at x, computing the distances and kernels once
+		void EvaluateWithPartials( const VectorType& x, VectorType& f, MatrixType& J ) const {
+			typename std::decay<decltype( std::declval<const RBFType&>()( x ) )>::type fr;
+			typename std::decay<decltype( std::declval<const RBFType&>().Derivative( x ) )>::type Jr;
+			f.noalias() = linear * x;
+			J = linear;
+			for( const auto& r : rbfs ) {
+				r.EvaluateWithPartials( x, fr, Jr );
+				f += fr;
+				J += Jr;
+			}
+		}
+
+		/**
+		 * \brief The scalar basis b(x) = [x; phi_1(x); ...; phi_K(x)] and its derivative.
+		 *
+		 * Only valid when IsScalarBasis<F>. The model is then x -> [linear, w_1, ..., w_K] b(x).
+		 */
+		void ComputeBasis( const VectorType& x, VectorXd& b, MatrixXd& Db ) const {
+			uint32_t m = stateDim + (uint32_t)rbfs.size();
+			b.resize( m );
+			Db.setZero( m, stateDim );
+			b.head( stateDim ) = x;
+			Db.topRows( stateDim ).setIdentity();
+			for(size_t k=0;k<rbfs.size();++k) {
+				b( stateDim + k ) = rbfs[k].BasisValue( x );
+				Db.row( stateDim + k ) = rbfs[k].BasisGradient( x ).transpose();
+			}
+		}
+
 		void LoadCentresText( const char* filename ) {
 			ifstream in(filename);
 			if( !in ) return;
 
-			for( auto& r : rbfs )
+			for( auto& r : rbfs ) {
 				for(uint32_t j=0;j<stateDim;++j)
 					in >> r.centre[j];
+				UpdateOrbit( r );
+			}
 		}
 
 		void LoadCentresBinary( const char* filename ) {
 			ifstream in(filename);
 			if( !in ) return;
 
-			for( auto& r : rbfs )
+			for( auto& r : rbfs ) {
 				in.read( (char*)&r.centre[0], sizeof(double)*stateDim );
+				UpdateOrbit( r );
+			}
 		}
 
 		void WriteCSV( const char* filename ) const {
 			ofstream out(filename);
 			out.precision(16);
-			out << dimension << ',' << numRBFs << endl;
+			out << stateDim << ',' << rbfs.size() << endl;
 			for(uint32_t i=0;i<stateDim;++i) {	
 				for(uint32_t j=0;j<stateDim;++j)
 					out << linear(i,j) << ',';
@@ -83,6 +140,24 @@ namespace DRDSP {
 		}
 
 	};
+
+	const uint32_t maxFixedDimension = 4;   ///< The largest dimension DispatchDimension converts to a fixed size
+
+	/**
+	 * \brief Calls visit with the model converted to its fixed dimension, up to maxFixedDimension.
+	 *
+	 * Larger models are passed as they are. visit must return the same type for every dimension.
+	 */
+	template<typename F,typename Visitor>
+	auto DispatchDimension( const RBFModel<F>& model, Visitor&& visit ) -> decltype( visit(model) ) {
+		switch( model.stateDim ) {
+			case 1: return visit( RBFModel<F,1>(model) );
+			case 2: return visit( RBFModel<F,2>(model) );
+			case 3: return visit( RBFModel<F,3>(model) );
+			case 4: return visit( RBFModel<F,4>(model) );
+			default: return visit( model );
+		}
+	}
 }
 
 #endif
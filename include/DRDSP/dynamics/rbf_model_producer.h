@@ -2,6 +2,7 @@
 #define INCLUDED_DYNAMICS_RBF_MODEL_PRODUCER
 #include "rbf_model.h"
 #include "reduced_data.h"
+#include "centre_sampler.h"
 #include <cmath>
 #include <iostream>
 #include <sstream>
@@ -9,69 +10,83 @@
 #include "../data/histogram.h"
 #include "producer_base.h"
 #include "../misc.h"
+#include "../least_squares.h"
+#include "../philox.h"
 
 namespace DRDSP {
 
 	template<typename Family>
 	struct RBFModelProducer : ProducerBase {
 		typedef typename Family::Model Model;
+		CentreSampler sampler;
 		double boxScale = 1.5;
-		uint32_t numRBFs;
+		uint32_t numRBFs,
+		         seed = mt19937::default_seed;
 
 		explicit RBFModelProducer( uint32_t numRBFs ) : numRBFs(numRBFs) {}
 
+		/// Uses SolveKronecker when the family allows it, otherwise SolveDense
 		VectorXd Solve( const Family& family, const ReducedData& data ) const {
-			MatrixXd A1, A2;
-			VectorXd y1, y2;
-			uint32_t ldim = family.paramDim;
-			uint32_t dim = data.dimension;
-			uint32_t dim2 = dim*dim;
-
-			A1.setZero( data.count * dim, ldim );
-			y1.setZero( data.count * dim );
-			y2.setZero( data.count * dim2 );
-			A2.setZero( data.count * dim2, ldim );
-
-			for(size_t i=0;i<data.count;++i) {
-				A1.block(i*dim,0,dim,ldim) = family.ComputeLinear( data.points[i] );
-			}
-			for(size_t i=0;i<data.count;++i) {
-				y1.segment(i*dim,dim) = data.vectors[i] - family.ComputeTranslation( data.points[i] );
-			}
-			for(size_t i=0;i<data.count;++i) {
-				A2.block(i*dim2,0,dim2,ldim) = family.ComputeLinearDerivative( data.points[i] );
-			}
-			for(size_t i=0;i<data.count;++i) {
-				y2.segment(i*dim2,dim2) = Vectorize( data.derivatives[i] - family.ComputeTranslationDerivative( data.points[i] ) );
-			}
-			
-			auto A = A1.transpose() * A1 * (fitWeight[0]/data.scales[0]) + A2.transpose() * A2 * (fitWeight[1]/data.scales[1]);
-			auto b = A1.transpose() * y1 * (fitWeight[0]/data.scales[0]) + A2.transpose() * y2 * (fitWeight[1]/data.scales[1]);
+			return Solve( family, data, typename HasKroneckerStructure<Family>::type() );
+		}
+
+		/// Solves P G = R for the stateDim x m coefficient matrix P, see BasisCache::ComputeGram
+		VectorXd SolveKronecker( const Family& family, const ReducedData& data ) const {
+			BasisCache cache;
+			cache.Compute( family, data );
+			return SolveKronecker( cache );
+		}
 
-			Eigen::FullPivLU<MatrixXd> lu(A);
+		VectorXd SolveKronecker( const BasisCache& cache ) const {
+			MatrixXd G, R;
+			const BasisCache::Entry& e = cache.entries[0];
+			cache.ComputeGram( e, fitWeight[0]/e.scales[0], fitWeight[1]/e.scales[1], G, R );
+			Eigen::FullPivLU<MatrixXd> lu(G);
+			MatrixXd P = lu.solve( R.transpose() ).transpose();
+			return Vectorize(P);
+		}
+
+		VectorXd SolveDense( const Family& family, const ReducedData& data ) const {
+			double w1 = fitWeight[0] / data.scales[0];
+			double w2 = fitWeight[1] / data.scales[1];
+
+			Linearization<Family> linear( family );
+			NormalEquations eq = AccumulateNormalEquations( family.paramDim, data.count, fitThreads,
+				[&]( NormalEquations& partial, size_t i ) {
+					const VectorXd& x = data.points[i];
+					partial.Add( linear.ComputeLinear(x), data.vectors[i] - family.ComputeTranslation(x), w1 );
+					partial.Add( linear.ComputeLinearDerivative(x), Vectorize( data.derivatives[i] - family.ComputeTranslationDerivative(x) ), w2 );
+				}
+			);
+
+			Eigen::FullPivLU<MatrixXd> lu( eq.Matrix() );
 			if( !lu.isInjective() ) {
 				//cout << "Matrix not injective, rank = " << lu.rank() << " != (" << lu.matrixLU().rows() << ',' << lu.matrixLU().cols() << ")" << endl;
 			}
-			return lu.solve(b);
+			return lu.solve( eq.Aty );
 		}
 
 		Model BruteForce( const ReducedData& data, uint32_t numIterations ) const {
 			double cost = 0.0, bestCost = -1.0;
 
-			Model family( data.dimension, numRBFs );
-			Model model, best;
+			Family family( data.dimension, numRBFs );
+			Model best;
 			AABB box = data.ComputeBoundingBox();
 			box.Scale(boxScale);
 			vector<double> costs(numIterations);
-			mt19937 mt;
+
+			VectorXd theta;
+			BasisCache cache;
+			CentreSampler centreSampler( sampler );
+			centreSampler.SetCloud( data );
 
 			for(uint32_t i=0;i<numIterations;++i) {
-				SetPointsRandom( family.centres, box, mt );
-				model = family( Solve( family, data ) );
-				costs[i] = ComputeTotalCost( model, data );
+				Philox4x32 rng( seed, i );
+				centreSampler.Sample( family.centres, box, rng );
+				costs[i] = Fit( family, data, cache, theta, typename HasKroneckerStructure<Family>::type() );
 				if( costs[i] < bestCost || i==0 ) {
 					bestCost = costs[i];
-					best = model;
+					best = family( theta );
 					cout << i << " \t" << bestCost << endl;
 				}
 			}
@@ -79,60 +94,78 @@ namespace DRDSP {
 			return best;
 		}
 
+		/**
+		 * \brief Splits the iterations across numThreads threads.
+		 *
+		 * The centres of iteration i are drawn from the Philox4x32 stream ( seed, i ) and ties in cost
+		 * go to the lowest iteration, so the result does not depend on numThreads.
+		 */
 		Model BruteForce( const ReducedData& data, uint32_t numIterations, uint32_t numThreads ) const {
-			vector<Model> best(numThreads);
 			AABB box = data.ComputeBoundingBox();
 			box.Scale(boxScale);
-			uint32_t k = data.dimension * numRBFs;
-			vector<future<void>> futures(numThreads);
-			uint32_t iterationsPerThread = numIterations / numThreads;
-			for(uint32_t i=0;i<numThreads;++i) {
-				futures[i] = async( launch::async,
-					[=,&data,&box]( Model& out ){
-						out = BruteForce( data,
-										  box,
-										  mt19937::default_seed + i * k,
-										  iterationsPerThread );
-					}, ref(best[i])
-				);
-			}
+			CentreSampler centreSampler( sampler );
+			centreSampler.SetCloud( data );
+			vector<Result> best( std::max( 1u, numThreads ) );
 
-			vector<double> costs(numThreads);
+			ParallelRanges( numIterations, numThreads, [&]( size_t begin, size_t end, uint32_t thread ) {
+				best[thread] = BruteForce( data, box, centreSampler, (uint32_t)begin, (uint32_t)end );
+			});
 
-			for(uint32_t i=0;i<numThreads;++i) {
-				futures[i].wait();
-				costs[i] = ComputeTotalCost( best[i], data );
-			}
-
-			double bestCost = costs[0];
 			uint32_t bestIndex = 0;
-			for(uint32_t i=1;i<numThreads;++i) {
-				if( costs[i] < bestCost ) {
-					bestCost = costs[i];
+			for(uint32_t i=1;i<best.size();++i) {
+				if( best[i].cost < 0.0 ) continue;
+				if( best[bestIndex].cost < 0.0 || best[i].cost < best[bestIndex].cost ||
+				    ( best[i].cost == best[bestIndex].cost && best[i].iteration < best[bestIndex].iteration ) ) {
 					bestIndex = i;
 				}
 			}
-			return best[bestIndex];
+			return best[bestIndex].model;
 		}
 
 	protected:
 
-		Model BruteForce( const ReducedData& data, const AABB& box, uint32_t seed, uint32_t numIterations ) const {
-			double cost = 0.0, bestCost = -1.0;
-			uint32_t dim = data.dimension;
-			
-			Family family( dim, numRBFs );
-			Model model, best;
-			mt19937 mt(seed);
+		struct Result {
+			Model model;
+			double cost = -1.0;
+			uint32_t iteration = 0;
+		};
 
-			for(uint32_t i=0;i<numIterations;++i) {
-				SetPointsRandom( family.centres, box, mt );
-				model = family( Solve( family, data ) );
-				cost = ComputeTotalCost( model, data );
-				if( cost < bestCost || i==0 ) {
-					bestCost = cost;
-					best = model;
-					cout << i << " \t" << bestCost << endl;
+		VectorXd Solve( const Family& family, const ReducedData& data, std::true_type ) const {
+			return SolveKronecker( family, data );
+		}
+
+		VectorXd Solve( const Family& family, const ReducedData& data, std::false_type ) const {
+			return SolveDense( family, data );
+		}
+
+		/// One brute force iteration: fits theta for the current centres and returns its cost
+		double Fit( const Family& family, const ReducedData& data, BasisCache& cache, VectorXd& theta, std::true_type ) const {
+			cache.Compute( family, data );
+			theta = SolveKronecker( cache );
+			return ComputeTotalCost( theta, cache );
+		}
+
+		double Fit( const Family& family, const ReducedData& data, BasisCache&, VectorXd& theta, std::false_type ) const {
+			theta = SolveDense( family, data );
+			return ComputeTotalCost( family( theta ), data );
+		}
+
+		/// The best of iterations [begin,end)
+		Result BruteForce( const ReducedData& data, const AABB& box, const CentreSampler& centreSampler, uint32_t begin, uint32_t end ) const {
+			Family family( data.dimension, numRBFs );
+			Result best;
+			VectorXd theta;
+			BasisCache cache;
+
+			for(uint32_t i=begin;i<end;++i) {
+				Philox4x32 rng( seed, i );
+				centreSampler.Sample( family.centres, box, rng );
+				double cost = Fit( family, data, cache, theta, typename HasKroneckerStructure<Family>::type() );
+				if( cost < best.cost || best.cost < 0.0 ) {
+					best.cost = cost;
+					best.iteration = i;
+					best.model = family( theta );
+					cout << i << " \t" << cost << endl;
 				}
 			}
 			return best;
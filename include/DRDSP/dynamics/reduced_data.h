@@ -3,14 +3,9 @@
 #include "model.h"
 #include "../data/data_set.h"
 #include "../data/aabb.h"
+#include "../misc.h"
 
-#pragma warning( disable : 4510 ) // default constructor could not be generated
-#pragma warning( disable : 4610 ) // can never be instantiated - user defined constructor required
-
-#include <Eigen/SVD>
-
-#pragma warning( default : 4610 )
-#pragma warning( default : 4510 )
+#include <Eigen/QR>
 
 namespace DRDSP {
 
@@ -22,13 +17,16 @@ namespace DRDSP {
 		double scales[2];
 		size_t count = 0;
 		uint32_t dimension = 0;
+		uint64_t generation = 0;  ///< Unique to the current contents, set by Create, ReadData and Modified
 
 		ReducedData() = default;
 		ReducedData( uint32_t dim, size_t numPoints );
 		void Create( uint32_t dim, size_t numPoints );
+		void Modified();  ///< Call after changing points, vectors or derivatives in place, so that caches of them are refreshed
 		AABB ComputeBoundingBox() const;
 		double ComputeVectorScale();
 		double ComputeDerivativeScale();
+		ReducedData Subsample( size_t numPoints ) const;
 		const ReducedData& WriteData( const char* filename ) const;
 		bool ReadData( const char* filename );
 		const ReducedData& WritePointsCSV( const char* filename ) const;
@@ -37,19 +35,43 @@ namespace DRDSP {
 
 		template<typename Model>
 		ReducedData& ComputeData( Model&& original, const DataSet& data, const MatrixXd& W ) {
-			Create( (uint32_t)W.cols(), data.points.size() );
+			return ComputeData( original, data, W, 1 );
+		}
 
-			for(uint32_t i=0;i<count;++i) {
-				points[i].noalias() = W.adjoint() * data.points[i];
-			}
+		/**
+		 * \brief Projects the data set, splitting the points across numThreads threads.
+		 *
+		 * Points and vectors are gathered into columns and projected with a single product each.
+		 * Each thread keeps one n x d buffer for the product J W.
+		 */
+		template<typename Model>
+		ReducedData& ComputeData( Model&& original, const DataSet& data, const MatrixXd& W, uint32_t numThreads ) {
+			Create( (uint32_t)W.cols(), data.points.size() );
+			if( count == 0 ) return *this;
+
+			const int64_t n = W.rows();
+			MatrixXd X( n, count ), F( n, count );
+
+			ParallelRanges( count, numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+				MatrixXd JW( n, dimension );
+				VectorXd f;
+				typename std::decay<decltype( original.Partials( data.points[0] ) )>::type J;
+				for(size_t i=begin;i<end;++i) {
+					X.col(i) = data.points[i];
+					EvaluateWithPartials( original, data.points[i], f, J );
+					F.col(i) = f;
+					JW = J * W;
+					derivatives[i].noalias() = W.adjoint() * JW;
+				}
+			});
 
-			for(uint32_t i=0;i<count;++i) {
-				vectors[i].noalias() = W.adjoint() * original( data.points[i] );
+			MatrixXd P = W.adjoint() * X;
+			MatrixXd V = W.adjoint() * F;
+			for(size_t i=0;i<count;++i) {
+				points[i] = P.col(i);
+				vectors[i] = V.col(i);
 			}
 
-			for(uint32_t i=0;i<count;++i) {
-				derivatives[i].noalias() = W.adjoint() * original.Partials( data.points[i] ) * W;
-			}
 			scales[0] = ComputeVectorScale();
 			scales[1] = ComputeDerivativeScale();
 			return *this;
@@ -57,32 +79,56 @@ namespace DRDSP {
 
 		template<typename Model,typename Embedded>
 		ReducedData& ComputeDataEmbedded( const ModelEmbedded<Model,Embedded>& original, const DataSet& data, const MatrixXd& W ) {
+			return ComputeDataEmbedded( original, data, W, 1 );
+		}
+
+		/**
+		 * \brief Projects a data set of an embedded model, splitting the points across numThreads threads.
+		 *
+		 * The derivative is W^T P D^* W A - s( I - A ), where P is the derivative of the embedded
+		 * vector field and A is the orthogonal projector onto the range of W^T D. The range is
+		 * found with a column pivoting QR of the small d x n matrix W^T D.
+		 */
+		template<typename Model,typename Embedded>
+		ReducedData& ComputeDataEmbedded( const ModelEmbedded<Model,Embedded>& original, const DataSet& data, const MatrixXd& W, uint32_t numThreads ) {
 			Create( (uint32_t)W.cols(), data.points.size() );
+			if( count == 0 ) return *this;
 
 			static const double stabilityFactor = 1.0;
+			const double threshold = original.model.stateDim * NumTraits<double>::epsilon();
+			MatrixXd X( W.rows(), count );
+
+			ParallelRanges( count, numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+				MatrixXd WtD, WtH, DtW, Q, M, A;
+				VectorXd v;
+				typename std::decay<decltype( original.model.Partials( data.points[0] ) )>::type J;
+				ColPivHouseholderQR<MatrixXd> qr( dimension, original.model.stateDim );
+				qr.setThreshold( threshold );
+				for(size_t i=begin;i<end;++i) {
+					const VectorXd& x = data.points[i];
+					X.col(i) = original.embedding(x);
+					EvaluateWithPartials( original.model, x, v, J );
+					ProjectEmbeddingDerivatives( original.embedding, x, v, W, WtD, WtH, DtW );
+					vectors[i].noalias() = WtD * v;
+
+					qr.compute( WtD );
+					uint32_t rank = (uint32_t)qr.rank();
+					Q = qr.householderQ();
+					A.noalias() = Q.leftCols(rank) * Q.leftCols(rank).transpose();
+
+					WtH += WtD * J;
+					M.noalias() = WtH * DtW;
+					M.diagonal().array() += stabilityFactor;
+					derivatives[i].noalias() = M * A;
+					derivatives[i].diagonal().array() -= stabilityFactor;
+				}
+			});
 
-			for(uint32_t i=0;i<count;++i) {
-				points[i].noalias() = W.adjoint() * original.embedding(data.points[i]);
-			}
-
-			for(uint32_t i=0;i<count;++i) {
-				vectors[i].noalias() = W.adjoint() * original( data.points[i] );
+			MatrixXd P = W.adjoint() * X;
+			for(size_t i=0;i<count;++i) {
+				points[i] = P.col(i);
 			}
 
-			MatrixXd A;
-			JacobiSVD<MatrixXd> svd;
-			for(uint32_t i=0;i<count;++i) {
-				svd.compute( W.adjoint() * original.embedding.Derivative(data.points[i]), ComputeThinU );
-				uint32_t rank = 0;
-				double tolerance = original.model.stateDim * eps(svd.singularValues()(0));
-				for(int j=0;j<svd.nonzeroSingularValues();++j) {
-					if( svd.singularValues()(j) > tolerance )
-						++rank;
-					else break;
-				}
-				A.noalias() = svd.matrixU().leftCols(rank) * svd.matrixU().leftCols(rank).transpose();
-				derivatives[i].noalias() = W.adjoint() * original.Partials( data.points[i] ) * original.embedding.DerivativeAdjoint(data.points[i]) * W * A - stabilityFactor * ( MatrixXd::Identity(A.rows(),A.cols()) - A );
-			}
 			scales[0] = ComputeVectorScale();
 			scales[1] = ComputeDerivativeScale();
 			return *this;
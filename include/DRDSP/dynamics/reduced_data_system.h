@@ -30,13 +30,16 @@ namespace DRDSP {
 			Create( data.numParameters );
 			
 			vector<future<void>> futures(numThreads);
+
+			// threads not needed across parameters are spent within each data set
+			uint32_t pointThreads = max( 1u, numThreads / max( 1u, min( numParameters, numThreads ) ) );
 			
 			for(uint32_t i=0;i<numParameters;i+=numThreads) {
 				uint32_t N = min( numParameters - i, numThreads );
 				for(uint32_t j=0;j<N;++j) {
 					futures[j] = async( launch::async,
 						[&]( ReducedData& rData, const VectorXd& parameter, const DataSet& dataSet ) {
-							rData.ComputeData( family(parameter), dataSet, W );
+							rData.ComputeData( family(parameter), dataSet, W, pointThreads );
 						},
 						ref(reducedData[i+j]), cref(data.parameters[i+j]), cref(data.dataSets[i+j])
 					);
@@ -62,13 +65,15 @@ namespace DRDSP {
 			Create( data.numParameters );
 			
 			vector<future<void>> futures(numThreads);
+
+			uint32_t pointThreads = max( 1u, numThreads / max( 1u, min( numParameters, numThreads ) ) );
 			
 			for(uint32_t i=0;i<numParameters;i+=numThreads) {
 				uint32_t N = min( numParameters - i, numThreads );
 				for(uint32_t j=0;j<N;++j) {
 					futures[j] = async( launch::async,
 						[&]( ReducedData& rData, const VectorXd& parameter, const DataSet& dataSet ) {
-							rData.ComputeDataEmbedded( family(parameter), dataSet, W );
+							rData.ComputeDataEmbedded( family(parameter), dataSet, W, pointThreads );
 						},
 						ref(reducedData[i+j]), cref(data.parameters[i+j]), cref(data.dataSets[i+j])
 					);
@@ -85,6 +90,7 @@ namespace DRDSP {
 		const ReducedDataSystem& WriteVectorsCSV( const char* filePrefix, const char* fileSuffix ) const;
 		const ReducedDataSystem& WriteDerivativesCSV( const char* filePrefix, const char* fileSuffix ) const;
 		size_t TotalPoints() const;
+		ReducedDataSystem Subsample( size_t pointsPerSet ) const;
 
 		ReducedData& operator[]( size_t i ) {
 			return reducedData[i];
@@ -0,0 +1,116 @@
+#ifndef INCLUDED_DYNAMICS_SPARSE_BASIS_CACHE
+#define INCLUDED_DYNAMICS_SPARSE_BASIS_CACHE
+#include <vector>
+#include <Eigen/SparseCore>
+#include "reduced_data_system.h"
+#include "rbf_family.h"
+#include "local_rbf_model.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief The basis of an RBFFamily with compactly supported kernels, as sparse matrices.
+	 *
+	 * Stores the same B, Db, V and Y as BasisCache, but B and Db are sparse. Each point only has
+	 * entries for the kernels within reach of it, found with a LocalRBFModel. The Gram matrix is
+	 * then sparse as well, so thousands of centres can be fitted.
+	 */
+	struct SparseBasisCache {
+		struct Entry {
+			SparseMatrix<double> B,     ///< m x N basis values
+			                     Db;    ///< m x dN basis derivatives
+			MatrixXd V,                 ///< d x N vectors
+			         Y;                 ///< d x dN derivatives
+			double scales[2];
+			size_t count = 0;
+		};
+
+		vector<Entry> entries;
+		uint32_t dimension = 0,  ///< d, the dimension of the reduced space
+		         basisDim = 0;   ///< m, the number of scalar basis functions
+
+		template<typename R>
+		SparseBasisCache& Compute( const RBFFamily<RBF<R>>& family, const ReducedDataSystem& data ) {
+			entries.resize( data.numParameters );
+			LocalRBFModel<R> model( family( VectorXd::Zero(family.paramDim) ) );
+			for(uint32_t j=0;j<data.numParameters;++j) {
+				Compute( model, data[j], entries[j] );
+			}
+			return *this;
+		}
+
+		template<typename R>
+		SparseBasisCache& Compute( const RBFFamily<RBF<R>>& family, const ReducedData& data ) {
+			entries.resize( 1 );
+			Compute( LocalRBFModel<R>( family( VectorXd::Zero(family.paramDim) ) ), data, entries[0] );
+			return *this;
+		}
+
+		/// As BasisCache::ComputeGram, with a sparse G
+		void ComputeGram( const Entry& e, double w1, double w2, SparseMatrix<double>& G, MatrixXd& R ) const {
+			G = w1 * ( e.B * e.B.transpose() );
+			G += w2 * ( e.Db * e.Db.transpose() );
+			R.noalias() = w1 * ( e.V * e.B.transpose() );
+			R.noalias() += w2 * ( e.Y * e.Db.transpose() );
+		}
+
+		/// As BasisCache::ComputeCost
+		double ComputeCost( const Entry& e, const MatrixXd& P, double w1, double w2 ) const {
+			double S1 = ( P * e.B - e.V ).squaredNorm() / e.count;
+			double S2 = ( P * e.Db - e.Y ).squaredNorm() / e.count;
+			return w1 * S1 + w2 * S2;
+		}
+
+	protected:
+
+		template<typename R>
+		void Compute( const LocalRBFModel<R>& model, const ReducedData& data, Entry& e ) {
+			typedef Triplet<double> T;
+			dimension = data.dimension;
+			basisDim = dimension + (uint32_t)model.weights.cols();
+			e.count = data.count;
+			e.scales[0] = data.scales[0];
+			e.scales[1] = data.scales[1];
+
+			e.V.resize( dimension, data.count );
+			e.Y.resize( dimension, dimension * data.count );
+			vector<T> bt, dbt;
+			vector<uint32_t> indices;
+			VectorXd phi;
+			MatrixXd grad;
+			for(size_t i=0;i<data.count;++i) {
+				const VectorXd& x = data.points[i];
+				e.V.col(i) = data.vectors[i];
+				e.Y.middleCols( i * dimension, dimension ) = data.derivatives[i];
+				for(uint32_t j=0;j<dimension;++j) {
+					bt.emplace_back( j, (int)i, x(j) );
+					dbt.emplace_back( j, (int)( i * dimension + j ), 1.0 );
+				}
+				model.ComputeLocalBasis( x, indices, phi, grad );
+				for(size_t k=0;k<indices.size();++k) {
+					int row = (int)( dimension + indices[k] );
+					bt.emplace_back( row, (int)i, phi(k) );
+					for(uint32_t j=0;j<dimension;++j) {
+						dbt.emplace_back( row, (int)( i * dimension + j ), grad(k,j) );
+					}
+				}
+			}
+			e.B.resize( basisDim, data.count );
+			e.B.setFromTriplets( bt.begin(), bt.end() );
+			e.Db.resize( basisDim, dimension * data.count );
+			e.Db.setFromTriplets( dbt.begin(), dbt.end() );
+		}
+	};
+
+	/// Families whose scalar basis is sparse, fitted with SparseBasisCache
+	template<typename Family>
+	struct HasSparseBasis : std::false_type {};
+
+	template<typename R>
+	struct HasSparseBasis<RBFFamily<RBF<R>>> : HasCompactSupport<R> {};
+
+}
+
+#endif
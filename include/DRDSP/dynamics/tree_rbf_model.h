@@ -0,0 +1,251 @@
+#ifndef INCLUDED_DYNAMICS_TREE_RBF_MODEL
+#define INCLUDED_DYNAMICS_TREE_RBF_MODEL
+#include <cmath>
+#include <vector>
+#include "rbf_model.h"
+#include "centre_tree.h"
+
+using namespace std;
+
+namespace DRDSP {
+
+	/**
+	 * \brief The derivatives of x -> phi(|x|) for phi = PolyharmonicSpline<N>, at y with r = |y| > 0.
+	 *
+	 * The gradient is a y, the Hessian a I + b y y^T, and the third derivative
+	 * T_ijl = b ( y_l d_ij + y_i d_jl + y_j d_il ) + c y_i y_j y_l.
+	 */
+	template<int N>
+	struct PolyharmonicExpansion {
+		double phi, a, b, c;
+
+		explicit PolyharmonicExpansion( double r ) {
+			double d1, d2, d3, p = std::pow( r, N - 3 );
+			if( N % 2 == 0 ) {
+				double L = std::log(r);
+				phi = p * r * r * r * L;
+				d1 = p * r * r * ( N * L + 1.0 );
+				d2 = p * r * ( N * ( N - 1 ) * L + 2 * N - 1 );
+				d3 = p * ( N * ( N - 1 ) * ( N - 2 ) * L + 3 * N * N - 6 * N + 2 );
+			} else {
+				phi = p * r * r * r;
+				d1 = N * p * r * r;
+				d2 = N * ( N - 1 ) * p * r;
+				d3 = N * ( N - 1 ) * ( N - 2 ) * p;
+			}
+			a = d1 / r;
+			b = ( d2 - a ) / ( r * r );
+			c = ( ( d3 - b * r ) / ( r * r ) - 2.0 * b / r ) / r;
+		}
+	};
+
+	/**
+	 * \brief An RBFModel with PolyharmonicSpline<N> kernels, evaluated by Barnes-Hut summation over a CentreTree.
+	 *
+	 * A node whose radius is less than theta times its distance from x is replaced by the second
+	 * order expansion of its kernels about the node centre z. With y = x - z, d_k = c_k - z and g, H
+	 * the gradient and Hessian of phi(|y|),
+	 *
+	 *     sum_k w_k phi(|x - c_k|) ~ W phi(|y|) - M g + 1/2 sum_k w_k d_k^T H d_k,
+	 *
+	 * where W = sum_k w_k and M = sum_k w_k d_k^T. The Jacobian is the derivative of this
+	 * expansion. The error of a node is of order theta^3 relative to its terms, so theta trades
+	 * accuracy for speed, and theta = 0 gives the exact sum. An evaluation visits O(log K) far
+	 * nodes plus the nearby leaves, which suits models with thousands of centres in 2 to 4
+	 * dimensions.
+	 */
+	template<int N>
+	struct TreeRBFModel : Model<VectorXd> {
+		MatrixXd linear,
+		         weights;    ///< Column i is the weight of the kernel at tree.points.col(i)
+		CentreTree tree;
+		PolyharmonicSpline<N> func;
+		double theta = 0.5;  ///< Opening ratio, a node is expanded when radius < theta * distance
+
+		TreeRBFModel() = default;
+
+		explicit TreeRBFModel( const RBFModel<RBF<PolyharmonicSpline<N>>>& model, double theta = 0.5, uint32_t leafSize = 16 ) :
+			Model<VectorXd>(model.stateDim),
+			linear(model.linear),
+			theta(theta)
+		{
+			MatrixXd centres( model.stateDim, model.rbfs.size() ), w( model.stateDim, model.rbfs.size() );
+			for(size_t k=0;k<model.rbfs.size();++k) {
+				centres.col(k) = model.rbfs[k].centre;
+				w.col(k) = model.rbfs[k].weight;
+			}
+			tree.Build( centres, leafSize );
+			weights.resize( stateDim, w.cols() );
+			for(size_t i=0;i<tree.index.size();++i) {
+				weights.col(i) = w.col( tree.index[i] );
+			}
+			ComputeMoments();
+		}
+
+		VectorXd operator()( const VectorXd& x ) const {
+			VectorXd f = linear * x;
+			Traverse( x,
+				[&]( const CentreTree::Node& node ) {
+					for(uint32_t i=node.begin;i<node.end;++i) {
+						f.noalias() += weights.col(i) * func( ( x - tree.points.col(i) ).norm() );
+					}
+				},
+				[&]( uint32_t n, const VectorXd& y ) {
+					PolyharmonicExpansion<N> e( y.norm() );
+					f.noalias() += nodeWeights.col(n) * e.phi;
+					f.noalias() -= moments[n] * ( e.a * y );
+					for(uint32_t i=0;i<stateDim;++i) {
+						auto S = SecondMoment( n, i );
+						f(i) += 0.5 * ( e.a * S.trace() + e.b * y.dot( S * y ) );
+					}
+				}
+			);
+			return f;
+		}
+
+		MatrixXd Partials( const VectorXd& x ) const {
+			VectorXd f;
+			MatrixXd J;
+			EvaluateWithPartials( x, f, J );
+			return J;
+		}
+
+		void EvaluateWithPartials( const VectorXd& x, VectorXd& f, MatrixXd& J ) const {
+			f.noalias() = linear * x;
+			J = linear;
+			VectorXd r, g, Sy;
+			MatrixXd H;
+			double phi, dphi;
+			Traverse( x,
+				[&]( const CentreTree::Node& node ) {
+					for(uint32_t i=node.begin;i<node.end;++i) {
+						r = x - tree.points.col(i);
+						RadialValueGradient( func, r.norm(), phi, dphi );
+						f.noalias() += weights.col(i) * phi;
+						J.noalias() += weights.col(i) * ( dphi * r ).transpose();
+					}
+				},
+				[&]( uint32_t n, const VectorXd& y ) {
+					PolyharmonicExpansion<N> e( y.norm() );
+					g = e.a * y;
+					H.noalias() = e.b * y * y.transpose();
+					H.diagonal().array() += e.a;
+					f.noalias() += nodeWeights.col(n) * e.phi;
+					f.noalias() -= moments[n] * g;
+					J.noalias() += nodeWeights.col(n) * g.transpose();
+					J.noalias() -= moments[n] * H;
+					for(uint32_t i=0;i<stateDim;++i) {
+						auto S = SecondMoment( n, i );
+						double s2 = S.trace();
+						Sy.noalias() = S * y;
+						double ySy = y.dot( Sy );
+						f(i) += 0.5 * ( e.a * s2 + e.b * ySy );
+						J.row(i) += ( 0.5 * ( e.b * s2 + e.c * ySy ) ) * y.transpose() + e.b * Sy.transpose();
+					}
+				}
+			);
+		}
+
+		/**
+		 * \brief As RBFModel::ComputeBasis, with the far kernels from the expansion of their node.
+		 *
+		 * For a kernel at c in a far node, with d = c - z, phi(|x - c|) ~ phi(|y|) - g.d + d^T H d / 2,
+		 * and its gradient is the derivative of this. These need a few products per node rather than a
+		 * radial function per kernel.
+		 */
+		void ComputeBasis( const VectorXd& x, VectorXd& b, MatrixXd& Db ) const {
+			const int64_t K = weights.cols();
+			b.resize( stateDim + K );
+			Db.resize( stateDim + K, stateDim );
+			b.head( stateDim ) = x;
+			Db.topRows( stateDim ).setIdentity();
+			VectorXd r, g, yd, dd;
+			MatrixXd H, delta, dH;
+			double phi, dphi;
+			Traverse( x,
+				[&]( const CentreTree::Node& node ) {
+					for(uint32_t i=node.begin;i<node.end;++i) {
+						r = x - tree.points.col(i);
+						RadialValueGradient( func, r.norm(), phi, dphi );
+						b( stateDim + tree.index[i] ) = phi;
+						Db.row( stateDim + tree.index[i] ) = dphi * r.transpose();
+					}
+				},
+				[&]( uint32_t n, const VectorXd& y ) {
+					const CentreTree::Node& node = tree.nodes[n];
+					PolyharmonicExpansion<N> e( y.norm() );
+					g = e.a * y;
+					H.noalias() = e.b * y * y.transpose();
+					H.diagonal().array() += e.a;
+					delta = tree.points.middleCols( node.begin, node.end - node.begin ).colwise() - node.centre;
+					yd.noalias() = delta.transpose() * y;
+					dd = delta.colwise().squaredNorm().transpose();
+					dH.noalias() = delta.transpose() * H;
+					for(uint32_t i=node.begin,j=0;i<node.end;++i,++j) {
+						uint32_t row = stateDim + tree.index[i];
+						b( row ) = e.phi - e.a * yd(j) + 0.5 * ( e.a * dd(j) + e.b * yd(j) * yd(j) );
+						Db.row( row ) = g.transpose() - dH.row(j)
+						              + ( 0.5 * ( e.b * dd(j) + e.c * yd(j) * yd(j) ) ) * y.transpose()
+						              + ( e.b * yd(j) ) * delta.col(j).transpose();
+					}
+				}
+			);
+		}
+
+	protected:
+		MatrixXd nodeWeights;     ///< Column n is W for node n
+		vector<MatrixXd> moments, ///< M for each node
+		                 second;  ///< Row i of second[n] is sum_k w_ki vec(d_k d_k^T) for node n
+
+		/// sum_k w_ki d_k d_k^T for node n
+		Eigen::Map<const MatrixXd,0,Stride<Dynamic,Dynamic>> SecondMoment( uint32_t n, uint32_t i ) const {
+			const int64_t rows = second[n].rows();
+			return Eigen::Map<const MatrixXd,0,Stride<Dynamic,Dynamic>>( second[n].data() + i, stateDim, stateDim, Stride<Dynamic,Dynamic>( rows * stateDim, rows ) );
+		}
+
+		void ComputeMoments() {
+			const size_t count = tree.nodes.size();
+			nodeWeights.setZero( stateDim, count );
+			moments.assign( count, MatrixXd::Zero( stateDim, stateDim ) );
+			second.assign( count, MatrixXd::Zero( stateDim, stateDim * stateDim ) );
+			VectorXd d;
+			for(size_t n=0;n<count;++n) {
+				const CentreTree::Node& node = tree.nodes[n];
+				for(uint32_t i=node.begin;i<node.end;++i) {
+					d = tree.points.col(i) - node.centre;
+					nodeWeights.col(n) += weights.col(i);
+					moments[n].noalias() += weights.col(i) * d.transpose();
+					for(uint32_t l=0;l<stateDim;++l) {
+						second[n].middleCols( l * stateDim, stateDim ).noalias() += weights.col(i) * ( d(l) * d ).transpose();
+					}
+				}
+			}
+		}
+
+		/// Calls near(node) for each leaf that must be summed exactly and far(n, x - centre) for each expanded node
+		template<typename Near,typename Far>
+		void Traverse( const VectorXd& x, Near&& near, Far&& far ) const {
+			if( tree.nodes.empty() ) return;
+			int32_t stack[64];
+			int depth = 0;
+			stack[depth++] = 0;
+			VectorXd y;
+			while( depth > 0 ) {
+				int32_t n = stack[--depth];
+				const CentreTree::Node& node = tree.nodes[n];
+				y = x - node.centre;
+				if( node.radius < theta * y.norm() ) {
+					far( (uint32_t)n, y );
+				} else if( node.IsLeaf() ) {
+					near( node );
+				} else {
+					stack[depth++] = node.right;
+					stack[depth++] = node.left;
+				}
+			}
+		}
+	};
+
+}
+
+#endif
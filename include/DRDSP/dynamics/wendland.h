@@ -0,0 +1,122 @@
+#ifndef INCLUDED_DYNAMICS_WENDLAND
+#define INCLUDED_DYNAMICS_WENDLAND
+#include <complex>
+#include <limits>
+#include <type_traits>
+
+namespace DRDSP {
+
+	using std::real;
+
+	/**
+	 * \brief Wendland's compactly supported functions phi_{3,K}, zero for r >= radius.
+	 *
+	 * These are positive definite in up to three dimensions and have 2K continuous derivatives.
+	 * With x = r / radius:
+	 * - K = 0: (1-x)^2
+	 * - K = 1: (1-x)^4 (4x+1)
+	 * - K = 2: (1-x)^6 (35x^2+18x+3)
+	 *
+	 * A kernel then only interacts with the points within radius of its centre, see LocalRBFModel.
+	 */
+	template<int K>
+	struct Wendland;
+
+	template<>
+	struct Wendland<0> {
+		double radius = 1.0;
+
+		Wendland() = default;
+
+		explicit Wendland( double radius ) : radius(radius) {}
+
+		template<typename T>
+		T operator()( T r ) const {
+			T x = r / radius;
+			if( real(x) >= 1.0 ) return T(0);
+			T s = T(1) - x;
+			return s * s;
+		}
+
+		template<typename T>
+		T Derivative( T r ) const {
+			T x = r / radius;
+			if( real(x) >= 1.0 ) return T(0);
+			return ( -2.0 / radius ) * ( T(1) - x );
+		}
+	};
+
+	template<>
+	struct Wendland<1> {
+		double radius = 1.0;
+
+		Wendland() = default;
+
+		explicit Wendland( double radius ) : radius(radius) {}
+
+		template<typename T>
+		T operator()( T r ) const {
+			T x = r / radius;
+			if( real(x) >= 1.0 ) return T(0);
+			T s = T(1) - x;
+			T s2 = s * s;
+			return s2 * s2 * ( T(4) * x + T(1) );
+		}
+
+		template<typename T>
+		T Derivative( T r ) const {
+			T x = r / radius;
+			if( real(x) >= 1.0 ) return T(0);
+			T s = T(1) - x;
+			return ( -20.0 / radius ) * x * s * s * s;
+		}
+	};
+
+	template<>
+	struct Wendland<2> {
+		double radius = 1.0;
+
+		Wendland() = default;
+
+		explicit Wendland( double radius ) : radius(radius) {}
+
+		template<typename T>
+		T operator()( T r ) const {
+			T x = r / radius;
+			if( real(x) >= 1.0 ) return T(0);
+			T s = T(1) - x;
+			T s3 = s * s * s;
+			return s3 * s3 * ( T(35) * x * x + T(18) * x + T(3) );
+		}
+
+		template<typename T>
+		T Derivative( T r ) const {
+			T x = r / radius;
+			if( real(x) >= 1.0 ) return T(0);
+			T s = T(1) - x;
+			T s2 = s * s;
+			return ( -56.0 / radius ) * x * s2 * s2 * s * ( T(5) * x + T(1) );
+		}
+	};
+
+	/// True for radial functions that vanish beyond SupportRadius
+	template<typename F>
+	struct HasCompactSupport : std::false_type {};
+
+	template<int K>
+	struct HasCompactSupport<Wendland<K>> : std::true_type {};
+
+	/// The distance beyond which the radial function is zero, infinite for global kernels
+	template<typename F>
+	double SupportRadius( const F& ) {
+		return std::numeric_limits<double>::infinity();
+	}
+
+	template<int K>
+	double SupportRadius( const Wendland<K>& func ) {
+		return func.radius;
+	}
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef INCLUDED_EIGEN_LOW_RANK
+#define INCLUDED_EIGEN_LOW_RANK
+#include <Eigen/Core>
+
+using namespace Eigen;
+
+namespace DRDSP {
+
+	/**
+	 * \brief A square matrix of the form diag(d) + U V^T.
+	 *
+	 * Products with an n x k matrix cost O(n k r) instead of O(n^2 k), where r is the number of
+	 * columns of U and V. Models can return this from Partials when their Jacobian has this structure.
+	 */
+	struct DiagonalLowRank {
+		VectorXd diagonal;  ///< d, the diagonal part
+		MatrixXd U, V;      ///< The low rank part, U V^T
+
+		DiagonalLowRank() = default;
+
+		DiagonalLowRank( int64_t n, int64_t rank ) {
+			setZero( n, rank );
+		}
+
+		DiagonalLowRank& setZero( int64_t n, int64_t rank ) {
+			diagonal.setZero( n );
+			U.setZero( n, rank );
+			V.setZero( n, rank );
+			return *this;
+		}
+
+		int64_t rows() const {
+			return diagonal.size();
+		}
+
+		int64_t cols() const {
+			return diagonal.size();
+		}
+
+		int64_t rank() const {
+			return U.cols();
+		}
+
+		MatrixXd ToDense() const {
+			MatrixXd J = U * V.transpose();
+			J.diagonal() += diagonal;
+			return J;
+		}
+
+		/// J X
+		template<typename Derived>
+		MatrixXd operator*( const MatrixBase<Derived>& X ) const {
+			MatrixXd r = diagonal.asDiagonal() * X;
+			r.noalias() += U * ( V.transpose() * X );
+			return r;
+		}
+
+		/// W^T J W
+		template<typename Derived>
+		MatrixXd Project( const MatrixBase<Derived>& W ) const {
+			MatrixXd r = W.transpose() * ( diagonal.asDiagonal() * W );
+			r.noalias() += ( W.transpose() * U ) * ( V.transpose() * W );
+			return r;
+		}
+
+		DiagonalLowRank& operator*=( double s ) {
+			diagonal *= s;
+			U *= s;
+			return *this;
+		}
+	};
+
+	/// X J
+	template<typename Derived>
+	MatrixXd operator*( const MatrixBase<Derived>& X, const DiagonalLowRank& J ) {
+		MatrixXd r = X * J.diagonal.asDiagonal();
+		r.noalias() += ( X * J.U ) * J.V.transpose();
+		return r;
+	}
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef INCLUDED_EIGEN_REVERSE
+#define INCLUDED_EIGEN_REVERSE
+#include <Eigen/Core>
+#include "reverse.h"
+
+using namespace std;
+using namespace Eigen;
+using namespace DRDSP;
+
+namespace Eigen {
+
+	template<typename T>
+	struct NumTraits<tvar<T>> {
+		enum {
+			IsInteger = 0,
+			IsSigned = 1,
+			IsComplex = 0,
+			RequireInitialization = 1,
+			ReadCost = 2 * NumTraits<T>::ReadCost,
+			AddCost = 4 * NumTraits<T>::AddCost,
+			MulCost = 4 * NumTraits<T>::MulCost + NumTraits<T>::AddCost
+		};
+		typedef tvar<T> Real;
+		typedef tvar<T> NonInteger;
+		typedef tvar<T> Nested;
+
+		static inline tvar<T> epsilon() {
+			return tvar<T>( NumTraits<T>::epsilon() );
+		}
+		static inline tvar<T> dummy_precision() {
+			return tvar<T>( NumTraits<T>::dummy_precision() );
+		}
+		static inline tvar<T> highest() {
+			return tvar<T>( NumTraits<T>::highest() );
+		}
+		static inline tvar<T> lowest() {
+			return tvar<T>( NumTraits<T>::lowest() );
+		}
+	};
+
+	namespace internal {
+		template<typename T>
+		struct scalar_product_traits<T,tvar<T>> {
+			enum {
+				Defined = 1
+			};
+			typedef tvar<T> ReturnType;
+		};
+
+		template<typename T>
+		struct scalar_product_traits<tvar<T>,T> {
+			enum {
+				Defined = 1
+			};
+			typedef tvar<T> ReturnType;
+		};
+
+		template<typename T>
+		struct conj_helper<tvar<T>,T,false,false> {
+			typedef tvar<T> Scalar;
+			EIGEN_STRONG_INLINE Scalar pmadd(const Scalar& x, const T& y, const Scalar& c) const {
+				return padd(c, pmul(x,y));
+			}
+			EIGEN_STRONG_INLINE Scalar pmul(const Scalar& x, const T& y) const {
+				return x*y;
+			}
+		};
+
+		template<typename T>
+		struct conj_helper<T,tvar<T>,false,false> {
+			typedef tvar<T> Scalar;
+			EIGEN_STRONG_INLINE Scalar pmadd(const T& x, const Scalar& y, const Scalar& c) const {
+				return padd(c, pmul(x,y));
+			}
+			EIGEN_STRONG_INLINE Scalar pmul(const T& x, const Scalar& y) const {
+				return x*y;
+			}
+		};
+
+	}
+}
+
+namespace DRDSP {
+
+	template<typename T,int Rows,int Cols>
+	using TapeMatrix = Matrix<tvar<T>,Rows,Cols>;
+
+	typedef TapeMatrix<double,-1,-1> TapeMatrixXd;
+	typedef TapeMatrix<double,-1,1>  TapeVectorXd;
+
+	/// Creates independent variables on the active tape with the given values
+	template<typename Derived>
+	Matrix<tvar<typename Derived::Scalar>,Derived::RowsAtCompileTime,Derived::ColsAtCompileTime> Variables( const MatrixBase<Derived>& x ) {
+		typedef typename Derived::Scalar Scalar;
+		Matrix<tvar<Scalar>,Derived::RowsAtCompileTime,Derived::ColsAtCompileTime> r( x.rows(), x.cols() );
+		for(int64_t j=0;j<r.cols();++j) {
+			for(int64_t i=0;i<r.rows();++i) {
+				r(i,j) = tvar<Scalar>::Variable( x(i,j) );
+			}
+		}
+		return r;
+	}
+
+	template<typename Derived>
+	MatrixXd ValuePart( const MatrixBase<Derived>& x ) {
+		MatrixXd r( x.rows(), x.cols() );
+		for(int64_t i=0;i<r.rows();++i) {
+			for(int64_t j=0;j<r.cols();++j) {
+				r(i,j) = x(i,j).x;
+			}
+		}
+		return r;
+	}
+
+}
+
+#endif
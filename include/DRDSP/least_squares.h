@@ -0,0 +1,202 @@
+#ifndef INCLUDED_LEAST_SQUARES
+#define INCLUDED_LEAST_SQUARES
+#include "types.h"
+#include "misc.h"
+#include <vector>
+#include <cmath>
+#include <Eigen/LU>
+#include <Eigen/QR>
+
+#pragma warning( disable : 4510 ) // default constructor could not be generated
+#pragma warning( disable : 4610 ) // can never be instantiated - user defined constructor required
+
+#include <Eigen/SVD>
+
+#pragma warning( default : 4610 )
+#pragma warning( default : 4510 )
+
+using namespace Eigen;
+
+namespace DRDSP {
+
+	/**
+	 * \brief Accumulates the normal equations A^T A x = A^T y of a weighted least squares problem.
+	 *
+	 * Rows of A and y are added in blocks, so the full system is never stored. Only the lower
+	 * triangle of A^T A is accumulated.
+	 */
+	struct NormalEquations {
+		MatrixXd AtA;
+		VectorXd Aty;
+
+		NormalEquations() = default;
+
+		explicit NormalEquations( int64_t n ) {
+			Reset(n);
+		}
+
+		void Reset( int64_t n ) {
+			AtA.setZero(n,n);
+			Aty.setZero(n);
+		}
+
+		/// Adds the rows weight * ( |A x - y|^2 )
+		template<typename DerivedA,typename DerivedY>
+		NormalEquations& Add( const MatrixBase<DerivedA>& A, const MatrixBase<DerivedY>& y, double weight = 1.0 ) {
+			AtA.selfadjointView<Lower>().rankUpdate( A.transpose(), weight );
+			Aty.noalias() += weight * ( A.transpose() * y );
+			return *this;
+		}
+
+		NormalEquations& operator+=( const NormalEquations& rhs ) {
+			AtA.triangularView<Lower>() += rhs.AtA;
+			Aty += rhs.Aty;
+			return *this;
+		}
+
+		/// The full symmetric matrix A^T A
+		MatrixXd Matrix() const {
+			MatrixXd M = AtA;
+			M.triangularView<StrictlyUpper>() = AtA.transpose();
+			return M;
+		}
+
+		VectorXd Solve() const {
+			return FullPivLU<MatrixXd>( Matrix() ).solve( Aty );
+		}
+	};
+
+	/**
+	 * \brief Accumulates normal equations of size n over count items using numThreads threads.
+	 *
+	 * addItem( eq, i ) adds the rows belonging to item i to eq. Each thread fills its own
+	 * partial sum and the partial sums are added at the end.
+	 */
+	template<typename F>
+	NormalEquations AccumulateNormalEquations( int64_t n, size_t count, uint32_t numThreads, F&& addItem ) {
+		std::vector<NormalEquations> partial( std::max( 1u, numThreads ) );
+		ParallelRanges( count, numThreads, [&]( size_t begin, size_t end, uint32_t thread ) {
+			NormalEquations& eq = partial[thread];
+			eq.Reset(n);
+			for(size_t i=begin;i<end;++i) {
+				addItem( eq, i );
+			}
+		});
+		NormalEquations result(n);
+		for( const auto& eq : partial ) {
+			if( eq.AtA.size() ) result += eq;
+		}
+		return result;
+	}
+
+	/**
+	 * \brief Accumulates the triangular factor of a tall least squares problem block by block (TSQR).
+	 *
+	 * Weighted rows of [A y] are buffered, and every blockRows rows the buffer is reduced by a
+	 * Householder QR to at most n+1 rows. Factors from different threads are merged the same way.
+	 * A^T A is never formed, so the conditioning of A is kept rather than squared, and the final
+	 * factor is solved with an SVD, which tolerates rank deficiency.
+	 */
+	struct TallSkinnyQR {
+		int64_t n = 0;
+
+		TallSkinnyQR() = default;
+
+		explicit TallSkinnyQR( int64_t n, int64_t blockRows = 0 ) {
+			Reset( n, blockRows );
+		}
+
+		void Reset( int64_t n, int64_t blockRows = 0 ) {
+			this->n = n;
+			if( blockRows <= 0 ) blockRows = 4 * ( n + 1 );
+			buffer.resize( blockRows + n + 1, n + 1 );
+			used = 0;
+		}
+
+		/// Adds the rows weight * ( |A x - y|^2 )
+		template<typename DerivedA,typename DerivedY>
+		TallSkinnyQR& Add( const MatrixBase<DerivedA>& A, const MatrixBase<DerivedY>& y, double weight = 1.0 ) {
+			int64_t k = A.rows();
+			Reserve( k );
+			double s = std::sqrt( weight );
+			buffer.block( used, 0, k, n ) = s * A;
+			buffer.block( used, n, k, 1 ) = s * y;
+			used += k;
+			return *this;
+		}
+
+		TallSkinnyQR& operator+=( const TallSkinnyQR& rhs ) {
+			Reserve( rhs.used );
+			buffer.middleRows( used, rhs.used ) = rhs.buffer.topRows( rhs.used );
+			used += rhs.used;
+			Compress();
+			return *this;
+		}
+
+		/// Reduces the buffered rows to an upper triangular factor
+		void Compress() {
+			if( used == 0 ) return;
+			HouseholderQR<MatrixXd> qr( buffer.topRows(used) );
+			int64_t r = std::min<int64_t>( used, n + 1 );
+			buffer.topRows(r) = qr.matrixQR().topRows(r).triangularView<Upper>();
+			used = r;
+		}
+
+		/// The factor [R r], with Q^T [A y] = [R r; 0 rho]
+		MatrixXd Factor() {
+			Compress();
+			return buffer.topRows(used);
+		}
+
+		/// The least squares solution, from an SVD of the n x n factor
+		VectorXd Solve() {
+			Compress();
+			if( used == 0 ) return VectorXd::Zero(n);
+			JacobiSVD<MatrixXd> svd( buffer.topLeftCorner( used, n ), ComputeThinU | ComputeThinV );
+			return svd.solve( buffer.block( 0, n, used, 1 ) );
+		}
+
+	protected:
+		MatrixXd buffer;
+		int64_t used = 0;
+
+		void Reserve( int64_t k ) {
+			if( used + k <= buffer.rows() ) return;
+			Compress();
+			if( used + k > buffer.rows() ) {
+				buffer.conservativeResize( used + k, NoChange );
+			}
+		}
+	};
+
+	/**
+	 * \brief Accumulates a TallSkinnyQR with n unknowns over count items using numThreads threads.
+	 *
+	 * addItem( qr, i ) adds the rows belonging to item i to qr. Each thread factorizes its own
+	 * range, then the factors are merged pairwise in a tree, one level at a time.
+	 */
+	template<typename F>
+	TallSkinnyQR AccumulateTSQR( int64_t n, size_t count, uint32_t numThreads, F&& addItem ) {
+		numThreads = std::max( 1u, numThreads );
+		std::vector<TallSkinnyQR> partial( numThreads, TallSkinnyQR(n) );
+		ParallelRanges( count, numThreads, [&]( size_t begin, size_t end, uint32_t thread ) {
+			TallSkinnyQR& qr = partial[thread];
+			for(size_t i=begin;i<end;++i) {
+				addItem( qr, i );
+			}
+			qr.Compress();
+		});
+		for(size_t stride=1;stride<partial.size();stride*=2) {
+			size_t pairs = ( partial.size() - stride + 2 * stride - 1 ) / ( 2 * stride );
+			ParallelRanges( pairs, numThreads, [&]( size_t begin, size_t end, uint32_t ) {
+				for(size_t k=begin;k<end;++k) {
+					partial[ 2 * stride * k ] += partial[ 2 * stride * k + stride ];
+				}
+			});
+		}
+		return partial[0];
+	}
+
+}
+
+#endif
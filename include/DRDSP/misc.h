@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <vector>
 #include <random>
+#include <future>
 #include "data/aabb.h"
 
 namespace DRDSP {
@@ -68,6 +69,36 @@ namespace DRDSP {
 		return V;
 	}
 
+	/**
+	 * \brief Splits [0,count) into contiguous ranges and calls f( begin, end, thread ) on each.
+	 *
+	 * The last range runs on the calling thread. With one thread, f is called directly.
+	 */
+	template<typename F>
+	void ParallelRanges( size_t count, uint32_t numThreads, F&& f ) {
+		numThreads = (uint32_t)std::max<size_t>( 1, std::min<size_t>( numThreads, count ) );
+		if( numThreads == 1 ) {
+			f( size_t(0), count, uint32_t(0) );
+			return;
+		}
+		std::vector<std::future<void>> futures( numThreads - 1 );
+		size_t chunk = count / numThreads,
+		       extra = count % numThreads,
+		       begin = 0;
+		for(uint32_t t=0;t<numThreads;++t) {
+			size_t end = begin + chunk + ( t < extra ? 1 : 0 );
+			if( t + 1 < numThreads ) {
+				futures[t] = std::async( std::launch::async, [&f,begin,end,t](){ f( begin, end, t ); } );
+			} else {
+				f( begin, end, t );
+			}
+			begin = end;
+		}
+		for(auto& fut : futures) {
+			fut.get();
+		}
+	}
+
 	void SetPointsRandom( std::vector<VectorXd>& points, const AABB& box, std::mt19937& mt );
 
 }
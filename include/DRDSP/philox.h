@@ -0,0 +1,78 @@
+#ifndef INCLUDED_PHILOX
+#define INCLUDED_PHILOX
+#include <cstdint>
+#include <limits>
+
+namespace DRDSP {
+
+	/**
+	 * \brief The Philox4x32-10 counter-based random number generator.
+	 *
+	 * Each output block is a bijection of a 128-bit counter under a 64-bit key, so a stream is
+	 * fixed by (key, stream) and independent of any other stream. This makes it suitable for
+	 * giving every trial of a parallel search its own reproducible random numbers.
+	 * Satisfies UniformRandomBitGenerator, so it can be used with the standard distributions.
+	 */
+	struct Philox4x32 {
+		typedef uint32_t result_type;
+
+		Philox4x32( uint64_t key, uint64_t stream ) {
+			Seed( key, stream );
+		}
+
+		void Seed( uint64_t key, uint64_t stream ) {
+			this->key[0] = (uint32_t)key;
+			this->key[1] = (uint32_t)( key >> 32 );
+			counter[0] = 0;
+			counter[1] = 0;
+			counter[2] = (uint32_t)stream;
+			counter[3] = (uint32_t)( stream >> 32 );
+			index = 4;
+		}
+
+		static constexpr result_type min() {
+			return 0;
+		}
+
+		static constexpr result_type max() {
+			return std::numeric_limits<result_type>::max();
+		}
+
+		result_type operator()() {
+			if( index == 4 ) {
+				Generate( counter, key, output );
+				if( ++counter[0] == 0 ) ++counter[1];
+				index = 0;
+			}
+			return output[index++];
+		}
+
+		/// The block for counter ctr under key k
+		static void Generate( const uint32_t ctr[4], const uint32_t k[2], uint32_t out[4] ) {
+			uint32_t c[4] = { ctr[0], ctr[1], ctr[2], ctr[3] };
+			uint32_t k0 = k[0], k1 = k[1];
+			for(int r=0;r<10;++r) {
+				uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+				uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+				uint32_t hi0 = (uint32_t)( p0 >> 32 ), lo0 = (uint32_t)p0;
+				uint32_t hi1 = (uint32_t)( p1 >> 32 ), lo1 = (uint32_t)p1;
+				c[0] = hi1 ^ c[1] ^ k0;
+				c[1] = lo1;
+				c[2] = hi0 ^ c[3] ^ k1;
+				c[3] = lo0;
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			for(int i=0;i<4;++i) {
+				out[i] = c[i];
+			}
+		}
+
+	protected:
+		uint32_t key[2], counter[4], output[4];
+		uint32_t index;
+	};
+
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef INCLUDED_REVERSE
+#define INCLUDED_REVERSE
+/**
+ * Reverse-mode automatic differentiation.
+ *
+ * Arithmetic on tvar<T> records each elementary operation on the active Tape. A single backward
+ * sweep over the tape then yields the derivatives of one output with respect to every input.
+ *
+ */
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace DRDSP {
+
+	template<typename T>
+	struct Tape {
+		static const uint32_t none = 0xFFFFFFFF;
+
+		/// An elementary operation with at most two operands
+		struct Node {
+			T weight[2];        ///< Partial derivatives with respect to the operands
+			uint32_t parent[2]; ///< Indices of the operands, or none
+		};
+
+		std::vector<Node> nodes;  ///< The arena, storage is kept between evaluations
+		std::vector<T> adjoints;
+
+		Tape() = default;
+
+		explicit Tape( size_t capacity ) {
+			nodes.reserve( capacity );
+		}
+
+		Tape( const Tape& ) = delete;
+		Tape& operator=( const Tape& ) = delete;
+
+		/// Discard the recorded operations, keeping the allocated storage
+		void Clear() {
+			nodes.clear();
+		}
+
+		uint32_t Size() const {
+			return (uint32_t)nodes.size();
+		}
+
+		uint32_t Push( uint32_t p0, T w0, uint32_t p1, T w1 ) {
+			Node n;
+			n.parent[0] = p0;
+			n.parent[1] = p1;
+			n.weight[0] = w0;
+			n.weight[1] = w1;
+			nodes.push_back( n );
+			return (uint32_t)nodes.size() - 1;
+		}
+
+		uint32_t Push( uint32_t p0, T w0 ) {
+			return Push( p0, w0, none, T(0) );
+		}
+
+		uint32_t PushVariable() {
+			return Push( none, T(0), none, T(0) );
+		}
+
+		/// Back-propagate from the given output node, filling adjoints for every node
+		const std::vector<T>& Backward( uint32_t output ) {
+			adjoints.assign( nodes.size(), T(0) );
+			if( output == none ) return adjoints;
+			adjoints[output] = T(1);
+			for(size_t i=output+1;i-->0;) {
+				T a = adjoints[i];
+				if( a == T(0) ) continue;
+				const Node& n = nodes[i];
+				if( n.parent[0] != none ) adjoints[n.parent[0]] += a * n.weight[0];
+				if( n.parent[1] != none ) adjoints[n.parent[1]] += a * n.weight[1];
+			}
+			return adjoints;
+		}
+
+		/// The tape that operations on the current thread are recorded to
+		static Tape*& Active() {
+			thread_local Tape* active = nullptr;
+			return active;
+		}
+
+		/// Makes a tape active for the lifetime of the scope
+		struct Scope {
+			Tape* previous;
+
+			explicit Scope( Tape& tape ) : previous( Active() ) {
+				Active() = &tape;
+			}
+
+			~Scope() {
+				Active() = previous;
+			}
+
+			Scope( const Scope& ) = delete;
+			Scope& operator=( const Scope& ) = delete;
+		};
+	};
+
+	/**
+	 * A real number that records its dependencies on the active tape.
+	 *
+	 * Values constructed from T are constants and are not recorded.
+	 */
+	template<typename T>
+	struct tvar {
+		T x;
+		uint32_t index;
+
+		tvar( T value = T() ) : x(value), index(Tape<T>::none) {}
+
+		tvar( T value, uint32_t index ) : x(value), index(index) {}
+
+		/// Creates an independent variable on the active tape
+		static tvar<T> Variable( T value ) {
+			return tvar<T>( value, Tape<T>::Active()->PushVariable() );
+		}
+
+		bool IsConstant() const {
+			return index == Tape<T>::none;
+		}
+
+		T value() const {
+			return x;
+		}
+
+		static tvar<T> Unary( T value, const tvar<T>& a, T da ) {
+			if( a.IsConstant() ) return tvar<T>(value);
+			return tvar<T>( value, Tape<T>::Active()->Push( a.index, da ) );
+		}
+
+		static tvar<T> Binary( T value, const tvar<T>& a, T da, const tvar<T>& b, T db ) {
+			if( a.IsConstant() ) return Unary( value, b, db );
+			if( b.IsConstant() ) return Unary( value, a, da );
+			return tvar<T>( value, Tape<T>::Active()->Push( a.index, da, b.index, db ) );
+		}
+
+		tvar<T> operator-() const {
+			return Unary( -x, *this, T(-1) );
+		}
+
+		tvar<T> operator+( const tvar<T>& rhs ) const {
+			return Binary( x + rhs.x, *this, T(1), rhs, T(1) );
+		}
+
+		tvar<T> operator-( const tvar<T>& rhs ) const {
+			return Binary( x - rhs.x, *this, T(1), rhs, T(-1) );
+		}
+
+		tvar<T> operator*( const tvar<T>& rhs ) const {
+			return Binary( x * rhs.x, *this, rhs.x, rhs, x );
+		}
+
+		tvar<T> operator/( const tvar<T>& rhs ) const {
+			T inv = T(1) / rhs.x;
+			return Binary( x * inv, *this, inv, rhs, -x * inv * inv );
+		}
+
+		tvar<T> operator+( T rhs ) const {
+			return Unary( x + rhs, *this, T(1) );
+		}
+
+		tvar<T> operator-( T rhs ) const {
+			return Unary( x - rhs, *this, T(1) );
+		}
+
+		tvar<T> operator*( T rhs ) const {
+			return Unary( x * rhs, *this, rhs );
+		}
+
+		tvar<T> operator/( T rhs ) const {
+			return Unary( x / rhs, *this, T(1) / rhs );
+		}
+
+		tvar<T>& operator+=( const tvar<T>& rhs ) { return *this = *this + rhs; }
+		tvar<T>& operator-=( const tvar<T>& rhs ) { return *this = *this - rhs; }
+		tvar<T>& operator*=( const tvar<T>& rhs ) { return *this = *this * rhs; }
+		tvar<T>& operator/=( const tvar<T>& rhs ) { return *this = *this / rhs; }
+		tvar<T>& operator+=( T rhs ) { return *this = *this + rhs; }
+		tvar<T>& operator-=( T rhs ) { return *this = *this - rhs; }
+		tvar<T>& operator*=( T rhs ) { return *this = *this * rhs; }
+		tvar<T>& operator/=( T rhs ) { return *this = *this / rhs; }
+
+		bool operator==( const tvar<T>& rhs ) const { return x == rhs.x; }
+		bool operator!=( const tvar<T>& rhs ) const { return x != rhs.x; }
+		bool operator< ( const tvar<T>& rhs ) const { return x <  rhs.x; }
+		bool operator> ( const tvar<T>& rhs ) const { return x >  rhs.x; }
+		bool operator<=( const tvar<T>& rhs ) const { return x <= rhs.x; }
+		bool operator>=( const tvar<T>& rhs ) const { return x >= rhs.x; }
+	};
+
+	template<typename T>
+	tvar<T> operator+( T lhs, const tvar<T>& rhs ) {
+		return rhs + lhs;
+	}
+
+	template<typename T>
+	tvar<T> operator-( T lhs, const tvar<T>& rhs ) {
+		return -rhs + lhs;
+	}
+
+	template<typename T>
+	tvar<T> operator*( T lhs, const tvar<T>& rhs ) {
+		return rhs * lhs;
+	}
+
+	template<typename T>
+	tvar<T> operator/( T lhs, const tvar<T>& rhs ) {
+		T inv = T(1) / rhs.x;
+		return tvar<T>::Unary( lhs * inv, rhs, -lhs * inv * inv );
+	}
+
+	template<typename T>
+	T real( const tvar<T>& v ) {
+		return v.x;
+	}
+
+	template<typename T>
+	tvar<T> abs( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::abs(v.x), v, v.x < T(0) ? T(-1) : T(1) );
+	}
+
+	template<typename T>
+	tvar<T> sqrt( const tvar<T>& v ) {
+		T s = std::sqrt(v.x);
+		return tvar<T>::Unary( s, v, T(0.5) / s );
+	}
+
+	template<typename T>
+	tvar<T> exp( const tvar<T>& v ) {
+		T e = std::exp(v.x);
+		return tvar<T>::Unary( e, v, e );
+	}
+
+	template<typename T>
+	tvar<T> log( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::log(v.x), v, T(1) / v.x );
+	}
+
+	template<typename T>
+	tvar<T> pow( const tvar<T>& v, T p ) {
+		T y = std::pow(v.x,p);
+		return tvar<T>::Unary( y, v, p * std::pow(v.x,p-T(1)) );
+	}
+
+	template<typename T>
+	tvar<T> pow( const tvar<T>& v, const tvar<T>& p ) {
+		T y = std::pow(v.x,p.x);
+		if( v.x == T(0) ) return tvar<T>::Unary( y, v, p.x == T(1) ? T(1) : T(0) );
+		return tvar<T>::Binary( y, v, p.x * y / v.x, p, y * std::log(v.x) );
+	}
+
+	template<typename T>
+	tvar<T> sin( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::sin(v.x), v, std::cos(v.x) );
+	}
+
+	template<typename T>
+	tvar<T> cos( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::cos(v.x), v, -std::sin(v.x) );
+	}
+
+	template<typename T>
+	tvar<T> tan( const tvar<T>& v ) {
+		T t = std::tan(v.x);
+		return tvar<T>::Unary( t, v, T(1) + t*t );
+	}
+
+	template<typename T>
+	tvar<T> atan( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::atan(v.x), v, T(1) / ( T(1) + v.x*v.x ) );
+	}
+
+	template<typename T>
+	tvar<T> atan2( const tvar<T>& y, const tvar<T>& x ) {
+		T r2 = x.x*x.x + y.x*y.x;
+		return tvar<T>::Binary( std::atan2(y.x,x.x), y, x.x / r2, x, -y.x / r2 );
+	}
+
+	template<typename T>
+	tvar<T> sinh( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::sinh(v.x), v, std::cosh(v.x) );
+	}
+
+	template<typename T>
+	tvar<T> cosh( const tvar<T>& v ) {
+		return tvar<T>::Unary( std::cosh(v.x), v, std::sinh(v.x) );
+	}
+
+	template<typename T>
+	tvar<T> tanh( const tvar<T>& v ) {
+		T t = std::tanh(v.x);
+		return tvar<T>::Unary( t, v, T(1) - t*t );
+	}
+
+	typedef Tape<double> Taped;
+	typedef tvar<double> tvard;
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include <DRDSP/dynamics/centre_grid.h>
+#include <algorithm>
+
+using namespace DRDSP;
+using namespace std;
+
+CentreGrid::CentreGrid( const vector<VectorXd>& points, double cellSize ) {
+	MatrixXd P( points.empty() ? 0 : points[0].size(), points.size() );
+	for(size_t i=0;i<points.size();++i) {
+		P.col(i) = points[i];
+	}
+	Build( P, cellSize );
+}
+
+CentreGrid::CentreGrid( const MatrixXd& points, double cellSize ) {
+	Build( points, cellSize );
+}
+
+void CentreGrid::Build( const MatrixXd& P, double size ) {
+	points = P;
+	cellSize = size;
+	cells.clear();
+	if( points.cols() == 0 ) {
+		origin.setZero( points.rows() );
+		return;
+	}
+	origin = points.rowwise().minCoeff();
+	vector<int64_t> cell( points.rows() );
+	for(int64_t i=0;i<points.cols();++i) {
+		for(int64_t j=0;j<points.rows();++j) {
+			cell[j] = (int64_t)floor( ( points(j,i) - origin(j) ) / cellSize );
+		}
+		cells[ Key(cell) ].push_back( (uint32_t)i );
+	}
+}
+
+uint64_t CentreGrid::Key( const vector<int64_t>& cell ) const {
+	uint64_t h = 14695981039346656037ull;
+	for( int64_t c : cell ) {
+		h ^= (uint64_t)c;
+		h *= 1099511628211ull;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+vector<uint64_t>& CentreGrid::NeighbourKeys( const VectorXd& x ) const {
+	static thread_local vector<uint64_t> keys;
+	static thread_local vector<int64_t> base, cell;
+	const int64_t dim = x.size();
+	base.resize( dim );
+	cell.resize( dim );
+	for(int64_t j=0;j<dim;++j) {
+		base[j] = (int64_t)floor( ( x(j) - origin(j) ) / cellSize );
+		cell[j] = base[j] - 1;
+	}
+	keys.clear();
+	for(;;) {
+		keys.push_back( Key(cell) );
+		int64_t j = 0;
+		for(;j<dim;++j) {
+			if( ++cell[j] <= base[j] + 1 ) break;
+			cell[j] = base[j] - 1;
+		}
+		if( j == dim ) break;
+	}
+	sort( keys.begin(), keys.end() );
+	keys.erase( unique( keys.begin(), keys.end() ), keys.end() );
+	return keys;
+}
@@ -0,0 +1,238 @@
+#include <DRDSP/dynamics/centre_sampler.h>
+#include <DRDSP/misc.h>
+#include <algorithm>
+#include <limits>
+
+using namespace DRDSP;
+using namespace std;
+
+namespace {
+
+	/// Joe and Kuo's primitive polynomials and initial direction numbers for dimensions 2 to 16
+	struct SobolDimension {
+		uint32_t s, a, m[6];
+	};
+
+	const SobolDimension sobolDimensions[] = {
+		{ 1,  0, {1} },
+		{ 2,  1, {1,3} },
+		{ 3,  1, {1,3,1} },
+		{ 3,  2, {1,1,1} },
+		{ 4,  1, {1,1,3,3} },
+		{ 4,  4, {1,3,5,13} },
+		{ 5,  2, {1,1,5,5,17} },
+		{ 5,  4, {1,1,5,5,5} },
+		{ 5,  7, {1,1,7,11,19} },
+		{ 5, 11, {1,1,5,1,1} },
+		{ 5, 13, {1,1,1,3,11} },
+		{ 5, 14, {1,3,5,5,31} },
+		{ 6,  1, {1,3,3,9,7,49} },
+		{ 6, 13, {1,1,1,15,21,21} },
+		{ 6, 16, {1,3,1,13,27,49} }
+	};
+
+	const uint32_t maxSobolDimension = 16;
+
+	void SobolDirections( uint32_t dimension, uint32_t v[32] ) {
+		if( dimension == 0 ) {
+			for(uint32_t b=0;b<32;++b) {
+				v[b] = 1u << (31-b);
+			}
+			return;
+		}
+		const SobolDimension& sd = sobolDimensions[dimension-1];
+		for(uint32_t b=0;b<sd.s;++b) {
+			v[b] = sd.m[b] << (31-b);
+		}
+		for(uint32_t b=sd.s;b<32;++b) {
+			v[b] = v[b-sd.s] ^ ( v[b-sd.s] >> sd.s );
+			for(uint32_t k=1;k<sd.s;++k) {
+				if( ( sd.a >> ( sd.s - 1 - k ) ) & 1u ) v[b] ^= v[b-k];
+			}
+		}
+	}
+
+	double RadicalInverse( uint64_t i, uint32_t base ) {
+		double inverse = 1.0 / base, f = inverse, r = 0.0;
+		while( i > 0 ) {
+			r += f * double( i % base );
+			i /= base;
+			f *= inverse;
+		}
+		return r;
+	}
+
+	vector<uint32_t> Primes( uint32_t count ) {
+		vector<uint32_t> primes;
+		for(uint32_t n=2;primes.size()<count;++n) {
+			bool prime = true;
+			for( uint32_t p : primes ) {
+				if( p * p > n ) break;
+				if( n % p == 0 ) {
+					prime = false;
+					break;
+				}
+			}
+			if( prime ) primes.push_back(n);
+		}
+		return primes;
+	}
+
+	template<typename Data>
+	void AppendPoints( vector<VectorXd>& cloud, const Data& data, size_t stride ) {
+		for(size_t i=0;i<data.count;i+=stride) {
+			cloud.push_back( data.points[i] );
+		}
+	}
+
+}
+
+bool CentreSampler::NeedsCloud() const {
+	return method == Method::KMeansPlusPlus || method == Method::PointCloud;
+}
+
+CentreSampler& CentreSampler::SetCloud( const ReducedData& data ) {
+	cloud.clear();
+	if( !NeedsCloud() ) return *this;
+	size_t stride = std::max<size_t>( 1, ( data.count + maxPoints - 1 ) / maxPoints );
+	AppendPoints( cloud, data, stride );
+	return *this;
+}
+
+CentreSampler& CentreSampler::SetCloud( const ReducedDataSystem& data ) {
+	cloud.clear();
+	if( !NeedsCloud() ) return *this;
+	size_t stride = std::max<size_t>( 1, ( data.TotalPoints() + maxPoints - 1 ) / maxPoints );
+	for(uint32_t j=0;j<data.numParameters;++j) {
+		AppendPoints( cloud, data[j], stride );
+	}
+	return *this;
+}
+
+void CentreSampler::Sample( vector<VectorXd>& centres, const AABB& box, mt19937& mt ) const {
+	SampleWith( centres, box, mt );
+}
+
+void CentreSampler::Sample( vector<VectorXd>& centres, const AABB& box, Philox4x32& rng ) const {
+	SampleWith( centres, box, rng );
+}
+
+template<typename Generator>
+void CentreSampler::SampleWith( vector<VectorXd>& centres, const AABB& box, Generator& mt ) const {
+	switch( method ) {
+		case Method::Halton:
+			SampleHalton( centres, box, mt );
+			break;
+		case Method::Sobol:
+			SampleSobol( centres, box, mt );
+			break;
+		case Method::KMeansPlusPlus:
+			if( cloud.empty() ) {
+				SampleUniform( centres, box, mt );
+			} else {
+				SampleKMeansPlusPlus( centres, mt );
+			}
+			break;
+		case Method::PointCloud:
+			if( cloud.empty() ) {
+				SampleUniform( centres, box, mt );
+			} else {
+				SamplePointCloud( centres, box, mt );
+			}
+			break;
+		default:
+			SampleUniform( centres, box, mt );
+	}
+}
+
+template<typename Generator>
+void CentreSampler::SampleUniform( vector<VectorXd>& centres, const AABB& box, Generator& mt ) const {
+	uniform_real_distribution<double> dist;
+	VectorXd diff = box.bMax - box.bMin;
+	for( auto& x : centres ) {
+		for(int64_t j=0;j<x.size();++j) {
+			x[j] = box.bMin(j) + diff(j) * dist(mt);
+		}
+	}
+}
+
+template<typename Generator>
+void CentreSampler::SampleHalton( vector<VectorXd>& centres, const AABB& box, Generator& mt ) const {
+	uint32_t dim = (uint32_t)box.bMin.size();
+	vector<uint32_t> primes = Primes( dim );
+	uint64_t start = uniform_int_distribution<uint32_t>( 0, 1u << 20 )( mt );
+	VectorXd diff = box.bMax - box.bMin;
+	for(size_t k=0;k<centres.size();++k) {
+		VectorXd& x = centres[k];
+		x.resize( dim );
+		for(uint32_t j=0;j<dim;++j) {
+			x[j] = box.bMin(j) + diff(j) * RadicalInverse( start + k + 1, primes[j] );
+		}
+	}
+}
+
+template<typename Generator>
+void CentreSampler::SampleSobol( vector<VectorXd>& centres, const AABB& box, Generator& mt ) const {
+	uint32_t dim = (uint32_t)box.bMin.size();
+	if( dim > maxSobolDimension ) {
+		SampleHalton( centres, box, mt );
+		return;
+	}
+	VectorXd diff = box.bMax - box.bMin;
+	uint32_t v[32];
+	for(uint32_t j=0;j<dim;++j) {
+		SobolDirections( j, v );
+		uint32_t shift = mt();
+		for(size_t k=0;k<centres.size();++k) {
+			uint32_t x = shift;
+			for(uint32_t b=0;b<32 && ( k >> b );++b) {
+				if( ( k >> b ) & 1u ) x ^= v[b];
+			}
+			centres[k].resize( dim );
+			centres[k][j] = box.bMin(j) + diff(j) * ( ( x + 0.5 ) / 4294967296.0 );
+		}
+	}
+}
+
+template<typename Generator>
+void CentreSampler::SampleKMeansPlusPlus( vector<VectorXd>& centres, Generator& mt ) const {
+	uniform_int_distribution<size_t> pick( 0, cloud.size() - 1 );
+	uniform_real_distribution<double> uniform;
+	vector<double> distance( cloud.size(), numeric_limits<double>::infinity() );
+
+	for(size_t k=0;k<centres.size();++k) {
+		size_t chosen = pick(mt);
+		if( k > 0 ) {
+			double total = 0.0;
+			for( double d : distance ) total += d;
+			if( total > 0.0 ) {
+				double target = total * uniform(mt);
+				chosen = cloud.size() - 1;
+				for(size_t i=0;i<cloud.size();++i) {
+					target -= distance[i];
+					if( target <= 0.0 ) {
+						chosen = i;
+						break;
+					}
+				}
+			}
+		}
+		centres[k] = cloud[chosen];
+		for(size_t i=0;i<cloud.size();++i) {
+			distance[i] = std::min( distance[i], ( cloud[i] - centres[k] ).squaredNorm() );
+		}
+	}
+}
+
+template<typename Generator>
+void CentreSampler::SamplePointCloud( vector<VectorXd>& centres, const AABB& box, Generator& mt ) const {
+	uniform_int_distribution<size_t> pick( 0, cloud.size() - 1 );
+	normal_distribution<double> normal;
+	VectorXd sigma = thickness * ( box.bMax - box.bMin );
+	for( auto& x : centres ) {
+		x = cloud[ pick(mt) ];
+		for(int64_t j=0;j<x.size();++j) {
+			x[j] = Clamp( x[j] + sigma(j) * normal(mt), box.bMin(j), box.bMax(j) );
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#include <DRDSP/dynamics/centre_tree.h>
+#include <algorithm>
+
+using namespace DRDSP;
+using namespace std;
+
+CentreTree::CentreTree( const MatrixXd& points, uint32_t leafSize ) {
+	Build( points, leafSize );
+}
+
+void CentreTree::Build( const MatrixXd& P, uint32_t leafSize ) {
+	points = P;
+	nodes.clear();
+	index.resize( P.cols() );
+	for(uint32_t i=0;i<index.size();++i) {
+		index[i] = i;
+	}
+	if( P.cols() == 0 ) return;
+	BuildNode( 0, (uint32_t)P.cols(), std::max<uint32_t>( leafSize, 1 ) );
+	MatrixXd sorted( P.rows(), P.cols() );
+	for(uint32_t i=0;i<index.size();++i) {
+		sorted.col(i) = P.col( index[i] );
+	}
+	points.swap( sorted );
+}
+
+int32_t CentreTree::BuildNode( uint32_t begin, uint32_t end, uint32_t leafSize ) {
+	int32_t id = (int32_t)nodes.size();
+	nodes.emplace_back();
+	{
+		Node& node = nodes[id];
+		node.begin = begin;
+		node.end = end;
+		node.left = node.right = -1;
+		node.centre.setZero( points.rows() );
+		for(uint32_t i=begin;i<end;++i) {
+			node.centre += points.col( index[i] );
+		}
+		node.centre /= double( end - begin );
+		node.radius = 0.0;
+		for(uint32_t i=begin;i<end;++i) {
+			node.radius = std::max( node.radius, ( points.col( index[i] ) - node.centre ).norm() );
+		}
+	}
+	if( end - begin <= leafSize ) return id;
+
+	VectorXd lo = points.col( index[begin] ), hi = lo;
+	for(uint32_t i=begin+1;i<end;++i) {
+		lo = lo.cwiseMin( points.col( index[i] ) );
+		hi = hi.cwiseMax( points.col( index[i] ) );
+	}
+	int64_t axis;
+	( hi - lo ).maxCoeff( &axis );
+	uint32_t mid = begin + ( end - begin ) / 2;
+	nth_element( index.begin() + begin, index.begin() + mid, index.begin() + end,
+		[&]( uint32_t a, uint32_t b ) { return points(axis,a) < points(axis,b); } );
+
+	int32_t left = BuildNode( begin, mid, leafSize );
+	int32_t right = BuildNode( mid, end, leafSize );
+	nodes[id].left = left;
+	nodes[id].right = right;
+	return id;
+}
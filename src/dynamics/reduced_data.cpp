@@ -1,3 +1,4 @@
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <DRDSP/dynamics/reduced_data.h>
@@ -15,7 +16,13 @@ ReducedData::ReducedData( uint32_t dim, size_t numPoints ) {
 	Create(dim,numPoints);
 }
 
+void ReducedData::Modified() {
+	static atomic<uint64_t> nextGeneration( 1 );
+	generation = nextGeneration++;
+}
+
 void ReducedData::Create( uint32_t dim, size_t numPoints ) {
+	Modified();
 	points.resize(numPoints);
 	vectors.resize(numPoints);
 	derivatives.resize(numPoints);
@@ -58,6 +65,24 @@ double ReducedData::ComputeDerivativeScale() {
 	return S2 / count;
 }
 
+/**
+ * A stratified subsample: the middle point of each of numPoints equal strata of the data.
+ * The scales are kept, so costs on the subsample are comparable with costs on the full data.
+ */
+ReducedData ReducedData::Subsample( size_t numPoints ) const {
+	numPoints = std::min( numPoints, count );
+	ReducedData sub( dimension, numPoints );
+	for(size_t i=0;i<numPoints;++i) {
+		size_t k = ( ( 2 * i + 1 ) * count ) / ( 2 * numPoints );
+		sub.points[i] = points[k];
+		sub.vectors[i] = vectors[k];
+		sub.derivatives[i] = derivatives[k];
+	}
+	sub.scales[0] = scales[0];
+	sub.scales[1] = scales[1];
+	return sub;
+}
+
 bool ReducedData::ReadData( const char* filename ) {
 	ifstream in(filename,ios::binary);
 	if( !in ) {
@@ -72,6 +97,7 @@ bool ReducedData::ReadData( const char* filename ) {
 	}
 	in.seekg(0, ios::beg);
 
+	Modified();
 	for(uint32_t k=0;k<count;++k) {
 		points[k].setZero(dimension);
 		vectors[k].setZero(dimension);
@@ -65,6 +65,14 @@ size_t ReducedDataSystem::TotalPoints() const {
 	return N;
 }
 
+ReducedDataSystem ReducedDataSystem::Subsample( size_t pointsPerSet ) const {
+	ReducedDataSystem sub( numParameters );
+	for(uint32_t i=0;i<numParameters;++i) {
+		sub.reducedData[i] = reducedData[i].Subsample( pointsPerSet );
+	}
+	return sub;
+}
+
 void DRDSP::Compare( const ReducedDataSystem& reducedData, const DataSystem& rdata ) {
 
 	ofstream out("output/comparison.csv");